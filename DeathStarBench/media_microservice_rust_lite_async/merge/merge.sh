@@ -16,11 +16,65 @@ LINKER_FLAGS="-lm -lz -ldl -lpthread"
 ARGS=("$@")
 NUM_ARGS=$#
 
+# content-addressed cache of the compile/opt/llc outputs, keyed by the tool,
+# its arguments and the contents of its input files, so a re-merge only redoes
+# the steps whose inputs changed. MERGE_CACHE_DIR="" turns it off.
+MERGE_CACHE_DIR=${MERGE_CACHE_DIR-$HOME/.cache/faas-merge}
+# MERGE_STATS=<file>: the merge passes append one JSON line per run to <file>
+# (./merge_tree.py stats sums them up), steps served from the cache add none
+STATS_FLAGS=${MERGE_STATS:+-merge-stats-json=$MERGE_STATS}
+# the rename/merge steps keep their intermediates in their own mktemp dir
+# (TMP), so merge_tree.py can run independent subtrees concurrently
+
+
+# cached <output> <command...>: run the command, which writes <output>, unless
+# a run with the same command line and the same input files is in the cache
+function cached {
+  OUT=$1
+  shift
+  if [ -z "$MERGE_CACHE_DIR" ]; then
+    "$@"
+    return
+  fi
+  KEY=$(for ARG in "$@"; do
+          # neither is the stats file the passes append to
+          case "$ARG" in -merge-stats-json=*) continue;; esac
+          # the per-step temp dir is not part of the key
+          if [ -n "$TMP" ]; then echo "${ARG//$TMP/tmp}"; else echo "$ARG"; fi
+          FILE=${ARG#*=}
+          if [ "$FILE" != "$OUT" ] && [ -f "$FILE" ]; then
+            if [ -x "$FILE" ]; then stat -c '%s %Y' "$FILE"; else sha256sum < "$FILE"; fi
+          fi
+        done | sha256sum | cut -d' ' -f1)
+  if [ -f $MERGE_CACHE_DIR/$KEY ]; then
+    cp $MERGE_CACHE_DIR/$KEY $OUT
+    return
+  fi
+  "$@" || return
+  mkdir -p $MERGE_CACHE_DIR
+  cp $OUT $MERGE_CACHE_DIR/$KEY.$$ && mv $MERGE_CACHE_DIR/$KEY.$$ $MERGE_CACHE_DIR/$KEY
+}
+
+
+# hash of a function's sources, the shared crates, the toolchain and the
+# compile recipe below
+function source_hash {
+  (cargo +nightly -V; rustc +nightly -V
+   find $1/template/rust/function OpenFaaSRPC DbInterface -type f -not -path "*/target/*" | sort | xargs sha256sum
+   sed -n '/^function compile_to_ir/,/^}/p' $0) | sha256sum | cut -d' ' -f1
+}
+
 
 function compile_to_ir {
   for i in $(seq 1 $(($NUM_ARGS-1)) );
   do
     FUNC_NAME=${ARGS[$i]}
+    # reuse the IR of a function whose inputs didn't change
+    KEY=compile-$(source_hash $FUNC_NAME)
+    if [ -n "$MERGE_CACHE_DIR" ] && [ -d $MERGE_CACHE_DIR/$KEY ]; then
+      rm -rf $FUNC_NAME && cp -r $MERGE_CACHE_DIR/$KEY $FUNC_NAME
+      continue
+    fi
     cp -r OpenFaaSRPC $FUNC_NAME/template/rust \
     && cp -r DbInterface $FUNC_NAME/template/rust \
     && cd $FUNC_NAME/template/rust/function \
@@ -30,6 +84,10 @@ function compile_to_ir {
     rm -rf $FUNC_NAME
     mv target/x86_64-unknown-linux-gnu $FUNC_NAME
     rm -rf target
+    if [ -n "$MERGE_CACHE_DIR" ] && [ -d $FUNC_NAME/$WORK_DIR ]; then
+      mkdir -p $MERGE_CACHE_DIR
+      cp -r $FUNC_NAME $MERGE_CACHE_DIR/$KEY.$$ && mv -T $MERGE_CACHE_DIR/$KEY.$$ $MERGE_CACHE_DIR/$KEY
+    fi
   done
 }
 
@@ -58,49 +116,56 @@ function remove_redundant {
 
 
 function rename_caller {
+  TMP=$(mktemp -d merge.XXXXXX)
   CALLER_FUNC=${ARGS[1]}
   CALLER_IR=$(find $CALLER_FUNC/$WORK_DIR/ -type f -name "function-*.bc" -not -name "*.*.*")
-  $LLVM_DIR/opt $CALLER_IR -passes=merge-rust-func-async -rename-caller-rra -caller-name-rra=$CALLER_FUNC -o caller.bc
-  cp caller.bc $CALLER_IR
+  cached $TMP/caller.bc $LLVM_DIR/opt $CALLER_IR -passes=merge-rust-func-async $STATS_FLAGS -rename-caller-rra -caller-name-rra=$CALLER_FUNC -o $TMP/caller.bc
+  cp $TMP/caller.bc $CALLER_IR
+  rm -rf $TMP
 }
 
 
 function rename_callee {
+  TMP=$(mktemp -d merge.XXXXXX)
   CALLEE_FUNC=${ARGS[1]}
   CALLEE_IR=$(find $CALLEE_FUNC/$WORK_DIR/ -type f -name "function-*.bc" -not -name "*.*.*")
-  $LLVM_DIR/opt $CALLEE_IR -passes=merge-rust-func-async -rename-callee-rra -callee-name-rra=$CALLEE_FUNC -o callee.bc
-  mv callee.bc $CALLEE_IR
+  cached $TMP/callee.bc $LLVM_DIR/opt $CALLEE_IR -passes=merge-rust-func-async $STATS_FLAGS -rename-callee-rra -callee-name-rra=$CALLEE_FUNC -o $TMP/callee.bc
+  mv $TMP/callee.bc $CALLEE_IR
+  rm -rf $TMP
 }
 
 
 function merge {
+  TMP=$(mktemp -d merge.XXXXXX)
   # prepare for merging
   CALLER_FUNC=${ARGS[1]}
   CALLER_IR=$(find $CALLER_FUNC/$WORK_DIR/ -type f -name "function-*.bc" -not -name "*.*.*")
   CALLEE_FUNC=${ARGS[2]}
   CALLEE_IR=$(find $CALLEE_FUNC/$WORK_DIR/ -type f -name "function-*.bc" -not -name "*.*.*")
   REAL_CALLER_FUNC=${ARGS[3]}
-  $LLVM_DIR/llvm-link $CALLER_IR $CALLEE_IR -o caller_and_callee.bc
-  $LLVM_DIR/opt caller_and_callee.bc -strip-debug -o caller_and_callee_nodebug.bc
-  $LLVM_DIR/opt caller_and_callee_nodebug.bc -passes=merge-rust-func-async \
-                 -merge-callee-rra -callee-name-rra=$CALLEE_FUNC \
-                 -caller-name-rra=$REAL_CALLER_FUNC -o merged.bc
+  cached $TMP/caller_and_callee.bc $LLVM_DIR/llvm-link $CALLER_IR $CALLEE_IR -o $TMP/caller_and_callee.bc
+  cached $TMP/merged.bc $LLVM_DIR/opt $TMP/caller_and_callee.bc -strip-debug -passes=merge-rust-func-async $STATS_FLAGS \
+                                       -merge-callee-rra -callee-name-rra=$CALLEE_FUNC \
+                                       -caller-name-rra=$REAL_CALLER_FUNC -o $TMP/merged.bc
   rm $CALLEE_IR
   cp $CALLEE_FUNC/$WORK_DIR/*.bc $CALLER_FUNC/$WORK_DIR
-  mv merged.bc $CALLER_IR
+  mv $TMP/merged.bc $CALLER_IR
+  rm -rf $TMP
 }
 
 
 
 function merge_existing {
+  TMP=$(mktemp -d merge.XXXXXX)
   CALLER_FUNC=${ARGS[1]} 
   CALLER_IR=$(find $CALLER_FUNC/$WORK_DIR/ -type f -name "function-*.bc" -not -name "*.*.*")
   CALLEE_FUNC=${ARGS[2]}
   REAL_CALLER_FUNC=${ARGS[3]}
-  $LLVM_DIR/opt $CALLER_IR -passes=merge-rust-func-async -merge-existing-rra \
-                 -caller-name-rra=$REAL_CALLER_FUNC -callee-name-rra=$CALLEE_FUNC \
-                 -o merged.bc
-  mv merged.bc $CALLER_IR
+  cached $TMP/merged.bc $LLVM_DIR/opt $CALLER_IR -passes=merge-rust-func-async $STATS_FLAGS -merge-existing-rra \
+                                       -caller-name-rra=$REAL_CALLER_FUNC -callee-name-rra=$CALLEE_FUNC \
+                                       -o $TMP/merged.bc
+  mv $TMP/merged.bc $CALLER_IR
+  rm -rf $TMP
 }
 
 
@@ -118,13 +183,27 @@ function wrap_shared_lib {
 }
 
 
+# split the merged module with llvm-split (SplitModule) and run llc on the
+# parts in parallel, CODEGEN_JOBS parts (default: one per core)
+function codegen {
+  JOBS=${CODEGEN_JOBS:-$(nproc)}
+  rm -f function.o function.part*
+  $LLVM_DIR/llvm-split -j $JOBS -o function.part function.bc
+  export -f cached
+  export MERGE_CACHE_DIR
+  ls function.part* | xargs -P $JOBS -I{} bash -c \
+    "cached {}.o $LLVM_DIR/llc -filetype=obj -O3 --function-sections --data-sections {} -o {}.o"
+  rm -f $(ls function.part* | grep -v '\.o$')
+}
+
+
 function link {
   CALLER_FUNC=${ARGS[1]}
-  $LLVM_DIR/llvm-link $CALLER_FUNC/$WORK_DIR/*.bc -o lib_with_debug_info.bc
-  $LLVM_DIR/opt lib_with_debug_info.bc -strip-debug -o lib.bc
-  $LLVM_DIR/opt lib.bc -passes=strip-dead-prototypes -o func.bc
-  $LLVM_DIR/opt func.bc -passes=remove-redundant -o function.bc
-  $LLVM_DIR/llc -filetype=obj -O3 --function-sections --data-sections function.bc -o function.o
+  cached lib_with_debug_info.bc $LLVM_DIR/llvm-link $CALLER_FUNC/$WORK_DIR/*.bc -o lib_with_debug_info.bc
+  # one pipeline, the merge passes report what they leave valid
+  cached function.bc $LLVM_DIR/opt lib_with_debug_info.bc -strip-debug \
+                     -passes=strip-dead-prototypes,rust-dedup,remove-redundant,merge-post-opt,mergefunc $STATS_FLAGS -o function.bc
+  codegen
   wrap_shared_lib
   #gcc -no-pie -flto -Wl,--strip-debug -Wl,--gc-sections -Wl,--as-needed -L$RUST_LIB *.o -o function $LINKER_FLAGS
   gcc -no-pie -flto -Wl,--strip-debug -Wl,--gc-sections -Wl,--as-needed *.o -o function $LINKER_FLAGS
@@ -1,6 +1,6 @@
 use mongodb::{bson::doc,sync::Client};
 use memcache::Client as memcached_client;
-use std::{fs::read_to_string, collections::HashMap};
+use std::{fs::read_to_string, collections::HashMap, sync::OnceLock};
 
 pub fn read_lines(filename: &str) -> Vec<String> {
   read_to_string(filename)
@@ -10,48 +10,47 @@ pub fn read_lines(filename: &str) -> Vec<String> {
       .collect()  // gather them together into a vector
 }
 
-pub fn get_mongodb_uri() -> String{
-  let passwords: Vec<String> = read_lines("/var/openfaas/secrets/mongodb-password");
+// the secrets don't change while the function is up, read each password
+// file once per process instead of for every connection
+fn read_password(filename: &str) -> String {
+  let passwords: Vec<String> = read_lines(filename);
   if passwords.len() == 0 {
     println!("no password found!");
   }
   if passwords.len() > 1 {
     println!("more than 1 passwords found!");
   }
-  let password = passwords[0].to_owned();
+  passwords[0].to_owned()
+}
+
+fn get_mongodb_password() -> &'static str {
+  static MONGODB_PASSWORD: OnceLock<String> = OnceLock::new();
+  MONGODB_PASSWORD.get_or_init(|| read_password("/var/openfaas/secrets/mongodb-password"))
+}
+
+fn get_redis_password() -> &'static str {
+  static REDIS_PASSWORD: OnceLock<String> = OnceLock::new();
+  REDIS_PASSWORD.get_or_init(|| read_password("/var/openfaas/secrets/redis-password"))
+}
+
+pub fn get_mongodb_uri() -> String{
   let mut uri: String = String::from("mongodb://root:");
-    uri.push_str(&password[..]);
-    uri.push_str("@mongodb.openfaas-db.svc.cluster.local:27017");
+  uri.push_str(get_mongodb_password());
+  uri.push_str("@mongodb.openfaas-db.svc.cluster.local:27017");
   uri
 }
 
 pub fn get_redis_rw_uri() -> String{
-  let passwords: Vec<String> = read_lines("/var/openfaas/secrets/redis-password");
-  if passwords.len() == 0 {
-    println!("no password found!");
-  }
-  if passwords.len() > 1 {
-    println!("more than 1 passwords found!");
-  }
-  let password = passwords[0].to_owned();
   let mut uri: String = String::from("redis://default:");
-  uri.push_str(&password[..]);
+  uri.push_str(get_redis_password());
   uri.push_str("@sn-redis-master.openfaas-db.svc.cluster.local:6379");
   uri
 }
 
 pub fn get_redis_ro_uri() -> String{
-  let passwords: Vec<String> = read_lines("/var/openfaas/secrets/redis-password");
-  if passwords.len() == 0 {
-    println!("no password found!");
-  }
-  if passwords.len() > 1 {
-    println!("more than 1 passwords found!");
-  }
-  let password = passwords[0].to_owned();
   let mut uri: String = String::from("redis://default:");
-    uri.push_str(&password[..]);
-    uri.push_str("@sn-redis-replicas.openfaas-db.svc.cluster.local:6379");
+  uri.push_str(get_redis_password());
+  uri.push_str("@sn-redis-replicas.openfaas-db.svc.cluster.local:6379");
   uri
 }
 
@@ -2,12 +2,67 @@
 import os
 import sys 
 import json
+import threading
+from concurrent.futures import ThreadPoolExecutor
 
+# merge.sh steps running at once, MERGE_JOBS overrides the core count
+merge_jobs = threading.Semaphore(int(os.environ.get("MERGE_JOBS", os.cpu_count())))
 
-def merge(f_name):
-  f = open(f_name, 'r')
-  Lines = f.readlines()
- 
+
+def run(cmd):
+  with merge_jobs:
+    print(cmd)
+    os.system(cmd)
+
+
+# the merge passes append one JSON line per run to MERGE_STATS (merge.sh),
+# by default <funcTree>.stats.json next to the funcTree
+def stats_file(f_name):
+  return os.environ.get("MERGE_STATS", os.path.abspath(f_name + ".stats.json"))
+
+
+def record_stats(f_name, fresh):
+  os.environ["MERGE_STATS"] = stats_file(f_name)
+  if fresh and os.path.exists(os.environ["MERGE_STATS"]):
+    os.remove(os.environ["MERGE_STATS"])
+
+
+def stats(f_name):
+  runs = []
+  with open(stats_file(f_name), 'r') as f:
+    for line in f:
+      if line.strip() != "":
+        runs.append(json.loads(line))
+  # where the time went: per pass mode and per phase
+  seconds = {}
+  phases = {}
+  for r in runs:
+    name = r["pass"] + (" " + r["mode"] if r["mode"] != "" else "")
+    seconds[name] = seconds.get(name, 0) + r["seconds"]
+    for phase in r["phases"]:
+      name = r["pass"] + "." + phase
+      phases[name] = phases.get(name, 0) + r["phases"][phase]
+  print("runs: " + str(len(runs)) + ", " + "%.3f" % sum(seconds.values()) + "s")
+  for name in sorted(seconds, key=seconds.get, reverse=True):
+    print("  %-40s %8.3fs" % (name, seconds[name]))
+  print("slowest phases:")
+  for name in sorted(phases, key=phases.get, reverse=True)[:5]:
+    print("  %-40s %8.3fs" % (name, phases[name]))
+  # what the merge bought: the make_rpc calls (network hops) that became
+  # direct calls, and the IR that went away with the dead functions
+  edges = {}
+  for r in runs:
+    for e in r["edges"]:
+      edge = e["caller"] + " -> " + e["callee"]
+      edges[edge] = edges.get(edge, 0) + e["rpcs"]
+  print("network hops removed: " + str(sum(edges.values())))
+  for edge in edges:
+    print("  %-60s %4d" % (edge, edges[edge]))
+  for key in ["funcs_cloned", "insts_cloned", "funcs_erased", "insts_erased", "demangle_lookups", "demangled"]:
+    print(key + ": " + str(sum(r[key] for r in runs)))
+
+
+def prepare(Lines, rename=True):
   func_visited = {}
   entry_func = ""
   # get the entry function
@@ -30,9 +85,10 @@ def merge(f_name):
   print(cmd)
   os.system(cmd)
   # rename caller
-  cmd = "./merge.sh rename_caller "+entry_func
-  print(cmd)
-  os.system(cmd)
+  if rename:
+    cmd = "./merge.sh rename_caller "+entry_func
+    print(cmd)
+    os.system(cmd)
   # delete useless files
   all_callees = ""
   for func in func_visited:
@@ -42,27 +98,113 @@ def merge(f_name):
   print(cmd)
   os.system(cmd)
   # rename callee
+  cmds = []
   for func in func_visited:
-    if func != entry_func:
-      cmd = "./merge.sh rename_callee "+func
-      print(cmd)
-      os.system(cmd)
-  # merge
-  merged_funcs = {}
-  merged_funcs[entry_func] = 1
+    if rename and func != entry_func:
+      cmds.append("./merge.sh rename_callee "+func)
+  with ThreadPoolExecutor(max_workers=max(len(cmds), 1)) as pool:
+    list(pool.map(run, cmds))
+  return entry_func, all_callees
+
+
+def get_edges(Lines):
+  edges = []
   for line in Lines:
     words = line.split()
-    caller = words[0]
-    callee = words[1]
+    if len(words) >= 2:
+      edges.append((words[0], words[1]))
+  return edges
+
+
+def reachable(func, edges):
+  funcs = {func}
+  todo = [func]
+  while len(todo) > 0:
+    caller = todo.pop()
+    for edge in edges:
+      if edge[0] == caller and edge[1] not in funcs:
+        funcs.add(edge[1])
+        todo.append(edge[1])
+  return funcs
+
+
+# merge the edges below root into root's module. A child whose subtree is only
+# reached through the child itself is merged into the child's own module first,
+# concurrently with the other such children, and then joins root as one callee
+def merge_subtree(root, edges):
+  children = []
+  for edge in edges:
+    if edge[0] == root and edge[1] not in children:
+      children.append(edge[1])
+  subtrees = {}
+  for child in children:
+    funcs = reachable(child, edges)
+    if len(funcs) < 2 or root in funcs:
+      continue
+    if all(edge[0] in funcs or edge == (root, child) for edge in edges if edge[1] in funcs):
+      subtrees[child] = funcs
+  with ThreadPoolExecutor(max_workers=max(len(subtrees), 1)) as pool:
+    list(pool.map(lambda child: merge_subtree(child, [edge for edge in edges if edge[0] in subtrees[child]]),
+                  subtrees))
+  # join the subtrees and merge the remaining edges in funcTree order
+  merged_funcs = {root}
+  for edge in edges:
+    caller = edge[0]
+    callee = edge[1]
+    if any(caller in funcs for funcs in subtrees.values()):
+      continue
     if callee not in merged_funcs:
-      cmd = "./merge.sh merge "+entry_func+" "+callee+" "+caller
-      print(cmd)
-      os.system(cmd)
-      merged_funcs[callee] = 1
+      run("./merge.sh merge "+root+" "+callee+" "+caller)
+      merged_funcs.update(subtrees.get(callee, {callee}))
     else:
-      cmd = "./merge.sh merge_existing "+entry_func+" "+callee+" "+caller
-      print(cmd)
-      os.system(cmd)
+      run("./merge.sh merge_existing "+root+" "+callee+" "+caller)
+
+
+def merge(f_name):
+  f = open(f_name, 'r')
+  Lines = f.readlines()
+  record_stats(f_name, True)
+  entry_func, all_callees = prepare(Lines)
+  merge_subtree(entry_func, get_edges(Lines))
+
+
+# only fuse the edges the call-freq / cpu-usage profile pays for
+def get_plan_flags(plan_args):
+  plan_flags = ""
+  if len(plan_args) > 0:
+    plan_flags = plan_flags + " -call-freq-rr=" + plan_args[0]
+  if len(plan_args) > 1:
+    plan_flags = plan_flags + " -cpu-usage-rr=" + plan_args[1]
+  if len(plan_args) > 2:
+    plan_flags = plan_flags + " -merge-size-budget-rr=" + plan_args[2]
+  if len(plan_args) > 3:
+    plan_flags = plan_flags + " -max-callee-cpu-rr=" + plan_args[3]
+  if plan_flags != "":
+    return "MERGE_PLAN_FLAGS='"+plan_flags.strip()+"' "
+  return ""
+
+
+def merge_once(f_name, plan_args):
+  f = open(f_name, 'r')
+  Lines = f.readlines()
+  record_stats(f_name, True)
+  entry_func, all_callees = prepare(Lines)
+  # merge all the edges in one opt run
+  cmd = get_plan_flags(plan_args)+"./merge.sh merge_tree "+entry_func+" "+f_name+" "+all_callees
+  print(cmd)
+  os.system(cmd)
+
+
+# compile, then rename, merge, link and codegen in one fn-merge process
+# (no separate 'link' step)
+def merge_fn(f_name, plan_args):
+  f = open(f_name, 'r')
+  Lines = f.readlines()
+  record_stats(f_name, True)
+  prepare(Lines, False)
+  cmd = get_plan_flags(plan_args)+"./merge.sh fn_merge "+f_name
+  print(cmd)
+  os.system(cmd)
 
 
 def link(f_name):
@@ -75,6 +217,7 @@ def link(f_name):
     if len(words) > 0:
       entry_func = words[0]
   # link
+  record_stats(f_name, False)
   cmd = "./merge.sh link " + entry_func
   print(cmd)
   os.system(cmd)
@@ -95,24 +238,30 @@ def clean(f_name):
   func_to_be_compiled = ""
   for func in func_visited:
     func_to_be_compiled = func_to_be_compiled + func + " "
-  cmd = "rm -rf "+func_to_be_compiled+" *.o *.bc *.txt function Implib.so"
+  cmd = "rm -rf "+func_to_be_compiled+" *.o *.bc *.txt function Implib.so "+stats_file(f_name)
   print(cmd)
   os.system(cmd)
 
 
 def main():
   if len(sys.argv) < 3:
-    print("usage: ./merge_tree.py <'merge' or 'clean'> <input file>")
+    print("usage: ./merge_tree.py <'merge', 'merge_once', 'merge_fn', 'link', 'stats' or 'clean'> <input file> [call-freq.json [cpu-usage.json [size budget [max callee cpu]]]]")
     exit(1)
   arg = sys.argv[1]
   if arg == "merge":
     merge(sys.argv[2])
+  elif arg == "merge_once":
+    merge_once(sys.argv[2], sys.argv[3:])
+  elif arg == "merge_fn":
+    merge_fn(sys.argv[2], sys.argv[3:])
   elif arg == "link":
     link(sys.argv[2])
+  elif arg == "stats":
+    stats(sys.argv[2])
   elif arg == "clean":
     clean(sys.argv[2])    
   else:
-    print("usage: ./merge_tree.py <'merge' or 'clean'> <input file>")
+    print("usage: ./merge_tree.py <'merge', 'merge_once', 'merge_fn', 'link', 'stats' or 'clean'> <input file> [call-freq.json [cpu-usage.json [size budget [max callee cpu]]]]")
     exit(1)
 
 
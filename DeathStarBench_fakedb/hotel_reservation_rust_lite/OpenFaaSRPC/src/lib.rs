@@ -1,5 +1,5 @@
 use curl::easy::{Easy};
-use std::{io::{self, Read, Write, BufReader}, error::Error, fs::{File, read_to_string}, path::Path, collections::HashMap};
+use std::{io::{self, Read, Write, BufReader}, error::Error, fs::{File, read_to_string}, path::Path, collections::HashMap, sync::OnceLock};
 use serde::{Deserialize, Serialize};
 
 pub static maxSearchResults: usize = 5;
@@ -343,17 +343,32 @@ pub fn read_lines(filename: &str) -> Vec<String> {
                  .collect()  // gather them together into a vector
 }
 
-pub fn make_rpc(func_name: &str, input: String) -> String {
+// the config files don't change while the function is up, read each of them
+// once per process instead of on every make_rpc (a fused binary runs the
+// make_rpc of every edge that stays behind an RPC)
+fn get_func_info_hash() -> &'static HashMap<String, i64> {
+  static FUNC_INFO_HASH: OnceLock<HashMap<String, i64>> = OnceLock::new();
+  FUNC_INFO_HASH.get_or_init(|| {
+    let func_vec = read_func_info_from_file("/home/rust/OpenFaaSRPC/func_info.json").unwrap();
+    func_vec.into_iter().map(|x| (x.function_name, x.cluster_id)).collect()
+  })
+}
 
-  let func_vec = read_func_info_from_file("/home/rust/OpenFaaSRPC/func_info.json").unwrap();
-  let func_info_hash: HashMap<String, i64> = func_vec.into_iter().map(|x| (x.function_name, x.cluster_id)).collect();
+fn get_ingress_enable() -> &'static str {
+  static INGRESS_ENABLE: OnceLock<String> = OnceLock::new();
+  INGRESS_ENABLE.get_or_init(|| {
+    let lines: Vec<String> = read_lines("/var/openfaas/secrets/ingress-enable");
+    lines[0].clone()
+  })
+}
+
+pub fn make_rpc(func_name: &str, input: String) -> String {
 
-  let callee_cluster_id: i64 = func_info_hash.get(func_name).unwrap().to_owned();
+  let callee_cluster_id: i64 = get_func_info_hash().get(func_name).unwrap().to_owned();
   let mut easy = Easy::new();
   let mut url = String::new();
 
-  let lines: Vec<String> = read_lines("/var/openfaas/secrets/ingress-enable");
-  let ingress_enable = lines[0].clone();
+  let ingress_enable = get_ingress_enable();
   if ingress_enable == "0" {  
     url = match callee_cluster_id {
       1 => String::from("http://gateway.openfaas.svc.cluster.local.:8080/function/"),
@@ -4,9 +4,57 @@ import sys
 import json
 
 
+# the merge passes append one JSON line per run to MERGE_STATS (merge.sh),
+# by default <funcTree>.stats.json next to the funcTree
+def stats_file(f_name):
+  return os.environ.get("MERGE_STATS", os.path.abspath(f_name + ".stats.json"))
+
+
+def record_stats(f_name, fresh):
+  os.environ["MERGE_STATS"] = stats_file(f_name)
+  if fresh and os.path.exists(os.environ["MERGE_STATS"]):
+    os.remove(os.environ["MERGE_STATS"])
+
+
+def stats(f_name):
+  runs = []
+  with open(stats_file(f_name), 'r') as f:
+    for line in f:
+      if line.strip() != "":
+        runs.append(json.loads(line))
+  # where the time went: per pass mode and per phase
+  seconds = {}
+  phases = {}
+  for r in runs:
+    name = r["pass"] + (" " + r["mode"] if r["mode"] != "" else "")
+    seconds[name] = seconds.get(name, 0) + r["seconds"]
+    for phase in r["phases"]:
+      name = r["pass"] + "." + phase
+      phases[name] = phases.get(name, 0) + r["phases"][phase]
+  print("runs: " + str(len(runs)) + ", " + "%.3f" % sum(seconds.values()) + "s")
+  for name in sorted(seconds, key=seconds.get, reverse=True):
+    print("  %-40s %8.3fs" % (name, seconds[name]))
+  print("slowest phases:")
+  for name in sorted(phases, key=phases.get, reverse=True)[:5]:
+    print("  %-40s %8.3fs" % (name, phases[name]))
+  # what the merge bought: the make_rpc calls (network hops) that became
+  # direct calls, and the IR that went away with the dead functions
+  edges = {}
+  for r in runs:
+    for e in r["edges"]:
+      edge = e["caller"] + " -> " + e["callee"]
+      edges[edge] = edges.get(edge, 0) + e["rpcs"]
+  print("network hops removed: " + str(sum(edges.values())))
+  for edge in edges:
+    print("  %-60s %4d" % (edge, edges[edge]))
+  for key in ["funcs_cloned", "insts_cloned", "funcs_erased", "insts_erased", "demangle_lookups", "demangled"]:
+    print(key + ": " + str(sum(r[key] for r in runs)))
+
+
 def merge(f_name):
   f = open(f_name, 'r')
   Lines = f.readlines()
+  record_stats(f_name, True)
  
   func_visited = {}
   entry_func = ""
@@ -75,6 +123,7 @@ def link(f_name):
     if len(words) > 0:
       entry_func = words[0]
   # link
+  record_stats(f_name, False)
   cmd = "./merge.sh link " + entry_func
   print(cmd)
   os.system(cmd)
@@ -95,24 +144,26 @@ def clean(f_name):
   func_to_be_compiled = ""
   for func in func_visited:
     func_to_be_compiled = func_to_be_compiled + func + " "
-  cmd = "rm -rf "+func_to_be_compiled+" *.o *.bc *.txt function Implib.so"
+  cmd = "rm -rf "+func_to_be_compiled+" *.o *.bc *.txt function Implib.so "+stats_file(f_name)
   print(cmd)
   os.system(cmd)
 
 
 def main():
   if len(sys.argv) < 3:
-    print("usage: ./merge_tree.py <'merge' or 'clean'> <input file>")
+    print("usage: ./merge_tree.py <'merge', 'link', 'stats' or 'clean'> <input file>")
     exit(1)
   arg = sys.argv[1]
   if arg == "merge":
     merge(sys.argv[2])
   elif arg == "link":
     link(sys.argv[2])
+  elif arg == "stats":
+    stats(sys.argv[2])
   elif arg == "clean":
     clean(sys.argv[2])    
   else:
-    print("usage: ./merge_tree.py <'merge' or 'clean'> <input file>")
+    print("usage: ./merge_tree.py <'merge', 'link', 'stats' or 'clean'> <input file>")
     exit(1)
 
 
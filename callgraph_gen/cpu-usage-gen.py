@@ -164,3 +164,6 @@ for i in range(180):
 print(max_cpu)
 print(max_func_cpu)
 print(sum_cpu/180)
+# per-function cpu at the peak, read by the merge planner (-cpu-usage-rr)
+with open("cpu-usage.json", "w") as f:
+  json.dump(max_func_cpu, f)
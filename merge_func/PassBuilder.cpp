@@ -318,9 +318,15 @@
 #include "llvm/Transforms/Vectorize/VectorCombine.h"
 #include <optional>
 
+#include "llvm/Transforms/Utils/MergeCABI.h"
+#include "llvm/Transforms/Utils/MergePostOpt.h"
 #include "llvm/Transforms/Utils/MergeRustFuncAsync.h"
 #include "llvm/Transforms/Utils/MergeRustFunc.h"
+#include "llvm/Transforms/Utils/MergeSymbolIndex.h"
 #include "llvm/Transforms/Utils/RemoveRedundant.h"
+#include "llvm/Transforms/Utils/RustDedup.h"
+#include "llvm/Transforms/Utils/RustDemangle.h"
+#include "llvm/Transforms/Utils/SwiftDemangle.h"
 
 using namespace llvm;
 
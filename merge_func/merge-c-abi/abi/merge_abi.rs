@@ -0,0 +1,28 @@
+// String <-> C string conversions the merge-c-abi bridge calls on the rust
+// side. Every C string crossing the bridge is malloc'ed and owned by the
+// receiver.
+use std::ffi::CStr;
+use std::os::raw::c_char;
+use std::ptr;
+
+extern "C" {
+    fn malloc(size: usize) -> *mut u8;
+    fn free(p: *mut c_char);
+}
+
+// takes the String the caller moved into make_rpc/send_return_value_to_caller
+#[no_mangle]
+pub unsafe extern "C" fn merge_abi_rust_to_c(s: *mut String) -> *mut c_char {
+    let s = ptr::read(s);
+    let out = malloc(s.len() + 1);
+    ptr::copy_nonoverlapping(s.as_ptr(), out, s.len());
+    *out.add(s.len()) = 0;
+    out as *mut c_char
+}
+
+// writes the String get_arg_from_caller/make_rpc would have returned
+#[no_mangle]
+pub unsafe extern "C" fn merge_abi_rust_from_c(out: *mut String, s: *mut c_char) {
+    ptr::write(out, CStr::from_ptr(s).to_string_lossy().into_owned());
+    free(s);
+}
@@ -0,0 +1,20 @@
+// String <-> C string conversions the merge-c-abi bridge calls on the swift
+// side. Every C string crossing the bridge is malloc'ed and owned by the
+// receiver. @_silgen_name keeps the swift calling convention, a String is
+// passed and returned as its two words.
+#if canImport(Glibc)
+import Glibc
+#else
+import Darwin
+#endif
+
+@_silgen_name("merge_abi_swift_to_c")
+public func mergeABISwiftToC(_ s: String) -> UnsafeMutablePointer<CChar> {
+  return strdup(s)!
+}
+
+@_silgen_name("merge_abi_swift_from_c")
+public func mergeABISwiftFromC(_ s: UnsafeMutablePointer<CChar>) -> String {
+  defer { free(s) }
+  return String(cString: s)
+}
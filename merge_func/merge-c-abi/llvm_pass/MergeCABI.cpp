@@ -0,0 +1,494 @@
+//===-- MergeCABI.cpp - Transformations -----------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Utils/MergeCABI.h"
+#include "llvm/Support/Debug.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "merge-c-abi"
+
+static cl::opt<bool> RenameCallee_cabi(
+                                     "rename-callee-cabi", cl::init(false),
+                                     cl::desc("rename the callee module before linking it to the caller"));
+
+static cl::opt<bool> MergeCallee_cabi(
+                                     "merge-callee-cabi", cl::init(false),
+                                     cl::desc("bridge the caller's make_rpc calls to the linked callee"));
+
+static cl::opt<std::string> CallerLang_cabi(
+                                     "caller-lang-cabi", cl::Hidden,
+                                     cl::desc("caller language: c, rust or swift"),
+                                     cl::init(""));
+
+static cl::opt<std::string> CalleeLang_cabi(
+                                     "callee-lang-cabi", cl::Hidden,
+                                     cl::desc("callee language: c, rust or swift"),
+                                     cl::init(""));
+
+static cl::opt<std::string> CalleeName_cabi(
+                                     "callee-name-cabi", cl::Hidden,
+                                     cl::desc("callee function name"),
+                                     cl::init(""));
+
+static cl::opt<std::string> CallerFunc_cabi(
+                                     "caller-func-cabi", cl::Hidden,
+                                     cl::desc("only bridge the make_rpc calls in this (mangled) caller function"),
+                                     cl::init(""));
+
+PreservedAnalyses MergeCABIPass::run(Module &M, ModuleAnalysisManager &AM) {
+  for (const std::string& lang : {CallerLang_cabi.getValue(), CalleeLang_cabi.getValue()}) {
+    if (lang != "c" && lang != "rust" && lang != "swift") {
+      llvm::errs()<<"MergeCABI: unsupported language '"<<lang<<"', expected c, rust or swift\n";
+      return PreservedAnalyses::all();
+    }
+  }
+  if (CalleeName_cabi.empty()) {
+    llvm::errs()<<"MergeCABI: -callee-name-cabi is required\n";
+    return PreservedAnalyses::all();
+  }
+
+  if (CallerLang_cabi == "rust" || CalleeLang_cabi == "rust") {
+    RustDemangler = &AM.getResult<RustDemangleAnalysis>(M);
+    Index = &AM.getResult<MergeSymbolIndexAnalysis>(M);
+  }
+  if (CallerLang_cabi == "swift" || CalleeLang_cabi == "swift")
+    SwiftDemangler = &AM.getResult<SwiftDemangleAnalysis>(M);
+
+  MergeStats RunStats("merge-c-abi", M);
+  Stats = &RunStats;
+  if (RenameCallee_cabi) {
+    RunStats.setMode("rename-callee");
+    MergePhase Phase(RunStats, "rename");
+    renameCallee(&M);
+    return getRenamePreservedAnalyses();
+  }
+  if (MergeCallee_cabi) {
+    RunStats.setMode("merge-callee");
+    mergeCallee(&M);
+    return getMergePreservedAnalyses();
+  }
+  return PreservedAnalyses::all();
+}
+
+
+
+// run on the callee module alone, before it is linked to the caller
+void MergeCABIPass::renameCallee(Module* M) {
+  Function* entry = nullptr;
+  for (Function& F : *M) {
+    if (!F.isDeclaration() && !findCallsTo(&F, CalleeLang_cabi, "get_arg_from_caller").empty()) {
+      entry = &F;
+      break;
+    }
+  }
+  if (!entry) {
+    llvm::errs()<<"MergeCABI: no function of "<<CalleeName_cabi<<" calls get_arg_from_caller\n";
+    return;
+  }
+  Function* mainFunc = M->getFunction("main");
+  if (mainFunc == entry) mainFunc = nullptr;
+
+  // c has a single namespace, keep the callee's symbols off the caller's
+  if (CalleeLang_cabi == "c") {
+    for (GlobalValue& GV : M->global_values()) {
+      if (GV.isDeclaration() || GV.hasLocalLinkage() || &GV == entry || &GV == mainFunc ||
+          GV.getName().starts_with("llvm.")) continue;
+      GV.setName(GV.getName() + "_callee_" + CalleeName_cabi);
+    }
+  }
+
+  if (mainFunc) {
+    if (CalleeLang_cabi == "rust") {
+      for (Instruction& I : instructions(mainFunc)) {
+        CallBase* call = dyn_cast<CallBase>(&I);
+        if (!call || !call->getCalledFunction()) continue;
+        call->getCalledFunction()->setName("_std_rt_lang_start_callee_" + CalleeName_cabi);
+        break;
+      }
+    }
+    mainFunc->setName("main_callee_" + CalleeName_cabi);
+  }
+  entry->setName("callee_entry_" + CalleeName_cabi);
+}
+
+
+
+void MergeCABIPass::mergeCallee(Module* M) {
+  Function* entry = getCalleeEntry(M);
+  if (!entry) return;
+  Function* bridge;
+  {
+    MergePhase Phase(*Stats, "clone");
+    bridge = createBridge(M, entry);
+  }
+  if (!bridge) return;
+
+  std::vector<CallBase*> rpcs;
+  bool found;
+  {
+    MergePhase Phase(*Stats, "find-rpcs");
+    found = findRPCs(M, bridge, rpcs);
+  }
+  if (!found) {
+    bridge->eraseFromParent();
+    return;
+  }
+  if (rpcs.empty()) {
+    llvm::errs()<<"MergeCABI: no make_rpc call to "<<CalleeName_cabi<<" found\n";
+    bridge->eraseFromParent();
+    return;
+  }
+  Stats->addClonedFunc(bridge);
+  unsigned bridged = 0;
+  // the bridged make_rpc calls per caller function
+  std::map<std::string, unsigned> callers;
+  {
+    MergePhase Phase(*Stats, "replace-rpcs");
+    for (CallBase* rpc : rpcs) {
+      std::string caller = rpc->getFunction()->getName().str();
+      if (!bridgeRPC(rpc, bridge)) continue;
+      callers[caller]++;
+      bridged++;
+    }
+  }
+  for (auto& caller : callers)
+    Stats->addMergedEdge(caller.first, CalleeName_cabi, caller.second);
+  LLVM_DEBUG(dbgs()<<"MergeCABI: "<<bridged<<" make_rpc call(s) to "<<CalleeName_cabi<<" bridged ("
+                  <<CallerLang_cabi<<" -> "<<CalleeLang_cabi<<")\n");
+
+  // the callee only runs through the bridge now
+  MergePhase Phase(*Stats, "erase");
+  const char* runtimeFuncs[] = {"main_callee_", "_std_rt_lang_start_callee_", "callee_entry_"};
+  for (const char* prefix : runtimeFuncs) {
+    Function* F = M->getFunction(prefix + CalleeName_cabi);
+    if (F && F->use_empty()) Stats->eraseFunction(F);
+  }
+}
+
+
+
+std::string MergeCABIPass::getName(Function* F, StringRef Lang) {
+  if (Lang == "rust") return RustDemangler->getDemangledName(F->getName());
+  if (Lang == "swift") return SwiftDemangler->getDemangledName(F->getName());
+  return F->getName().str();
+}
+
+
+
+// get_arg_from_caller, send_return_value_to_caller and make_rpc as seen from
+// each language's IR
+bool MergeCABIPass::isLangFunc(Function* F, StringRef Lang, StringRef BaseName) {
+  if (!F) return false;
+  std::string name = getName(F, Lang);
+  StringRef nameRef(name);
+  if (Lang == "rust") return nameRef.ends_with(("::" + BaseName).str());
+  if (Lang == "swift") return nameRef.contains(("." + BaseName + "(").str());
+  // renameCallee suffixed the callee's copy when it is written in c
+  return nameRef == BaseName || nameRef.starts_with((BaseName + "_callee_").str());
+}
+
+
+
+Function* MergeCABIPass::getCalleeEntry(Module* M) {
+  Function* entry = M->getFunction("callee_entry_" + CalleeName_cabi);
+  if (!entry || entry->isDeclaration()) {
+    llvm::errs()<<"MergeCABI: callee_entry_"<<CalleeName_cabi<<" not found, run -rename-callee-cabi on the callee first\n";
+    return nullptr;
+  }
+  return entry;
+}
+
+
+
+std::vector<CallBase*> MergeCABIPass::findCallsTo(Function* F, StringRef Lang, StringRef BaseName) {
+  std::vector<CallBase*> calls;
+  for (Instruction& I : instructions(F)) {
+    CallBase* call = dyn_cast<CallBase>(&I);
+    if (call && isLangFunc(call->getCalledFunction(), Lang, BaseName))
+      calls.push_back(call);
+  }
+  return calls;
+}
+
+
+
+// the make_rpc calls are the users of the few make_rpc functions, there is
+// no need to look at the instructions of every function of the caller.
+// Returns false when a swift caller names its callee in a way the pass can't
+// read and -caller-func-cabi doesn't pin down a single make_rpc call.
+bool MergeCABIPass::findRPCs(Module* M, Function* Bridge, std::vector<CallBase*>& RPCs) {
+  std::vector<CallBase*> unnamed;
+  unsigned total = 0;
+  for (Function& RPC : *M) {
+    if (!isLangFunc(&RPC, CallerLang_cabi, "make_rpc")) continue;
+    for (User* U : RPC.users()) {
+      CallBase* call = dyn_cast<CallBase>(U);
+      if (!call || call->getCalledFunction() != &RPC) continue;
+      Function* F = call->getFunction();
+      if (F == Bridge || F->getName().starts_with("callee_entry_" + CalleeName_cabi)) continue;
+      if (!CallerFunc_cabi.empty() && F->getName() != CallerFunc_cabi) continue;
+      total++;
+      if (CallerLang_cabi == "swift" && getSwiftRPCCalleeName(call).empty()) unnamed.push_back(call);
+      else if (isRPCToCallee(call)) RPCs.push_back(call);
+    }
+  }
+  if (unnamed.empty()) return true;
+  if (CallerFunc_cabi.empty() || total != 1) {
+    llvm::errs()<<"MergeCABI: the callee name of a make_rpc call in "<<unnamed[0]->getFunction()->getName()
+                <<" is not a string literal, pass -caller-func-cabi=<a function with a single make_rpc call>\n";
+    return false;
+  }
+  RPCs.push_back(unnamed[0]);
+  return true;
+}
+
+
+
+bool MergeCABIPass::isRPCToCallee(CallBase* RPC) {
+  if (CallerLang_cabi == "c") {
+    StringRef name;
+    return getConstantStringInfo(RPC->getArgOperand(0), name) && name == CalleeName_cabi;
+  }
+  if (CallerLang_cabi == "rust")
+    return Index->getRPCCalleeName(RPC) == CalleeName_cabi;
+  return getSwiftRPCCalleeName(RPC) == CalleeName_cabi;
+}
+
+
+
+// V as ptrtoint(GV) + Offset, the form swift gives the object word of a
+// String literal. GV is null for a plain integer.
+static bool getGlobalAndOffset(Value* V, const DataLayout& DL, GlobalVariable*& GV, APInt& Offset) {
+  if (ConstantInt* CI = dyn_cast<ConstantInt>(V)) {
+    Offset = CI->getValue();
+    return Offset.getBitWidth() == 64;
+  }
+  ConstantExpr* CE = dyn_cast<ConstantExpr>(V);
+  if (!CE) return false;
+  if (CE->getOpcode() == Instruction::IntToPtr) return getGlobalAndOffset(CE->getOperand(0), DL, GV, Offset);
+  if (CE->getOpcode() == Instruction::PtrToInt) {
+    APInt off(DL.getIndexTypeSizeInBits(CE->getOperand(0)->getType()), 0);
+    GV = dyn_cast<GlobalVariable>(CE->getOperand(0)->stripAndAccumulateConstantOffsets(DL, off, true));
+    Offset = off.sextOrTrunc(64);
+    return GV != nullptr;
+  }
+  if (CE->getOpcode() != Instruction::Add && CE->getOpcode() != Instruction::Sub) return false;
+  GlobalVariable *GV0 = nullptr, *GV1 = nullptr;
+  APInt off0, off1;
+  if (!getGlobalAndOffset(CE->getOperand(0), DL, GV0, off0) ||
+      !getGlobalAndOffset(CE->getOperand(1), DL, GV1, off1)) return false;
+  if (GV1 && (GV0 || CE->getOpcode() == Instruction::Sub)) return false;
+  GV = GV0 ? GV0 : GV1;
+  Offset = CE->getOpcode() == Instruction::Add ? off0 + off1 : off0 - off1;
+  return true;
+}
+
+
+
+// the callee name of a swift make_rpc, read back from the String literal
+// passed as {countAndFlags, object}. Up to 15 bytes are stored in the two
+// words themselves, the count in the top byte of object. A longer literal
+// has its count in the low 48 bits of countAndFlags and object points 32
+// bytes before its bytes, with the top bit set. "" when it is not a literal.
+std::string MergeCABIPass::getSwiftRPCCalleeName(CallBase* RPC) {
+  if (RPC->arg_size() < 2) return "";
+  const DataLayout& DL = RPC->getModule()->getDataLayout();
+  ConstantInt* countAndFlags = dyn_cast<ConstantInt>(RPC->getArgOperand(0));
+  GlobalVariable* GV = nullptr;
+  APInt object;
+  if (!countAndFlags || countAndFlags->getBitWidth() != 64 ||
+      !getGlobalAndOffset(RPC->getArgOperand(1), DL, GV, object)) return "";
+
+  uint64_t bits = countAndFlags->getZExtValue();
+  if (!GV) {
+    uint64_t objectBits = object.getZExtValue();
+    uint8_t discriminator = objectBits >> 56;
+    if (!(discriminator & 0x20)) return "";
+    unsigned count = discriminator & 0x0F;
+    std::string name;
+    for (unsigned i = 0; i < count; i++)
+      name.push_back((char)((i < 8 ? bits >> (8 * i) : objectBits >> (8 * (i - 8))) & 0xFF));
+    return name;
+  }
+
+  ConstantDataSequential* bytes = dyn_cast_or_null<ConstantDataSequential>(
+      GV->hasDefinitiveInitializer() ? GV->getInitializer() : nullptr);
+  if (!bytes || !bytes->isString()) return "";
+  // object = address - 32 + (1 << 63)
+  uint64_t start = (object + 32 - APInt::getSignMask(64)).getZExtValue();
+  uint64_t count = bits & 0x0000FFFFFFFFFFFFULL;
+  StringRef data = bytes->getRawDataValues();
+  if (start > data.size() || count > data.size() - start) return "";
+  return data.substr(start, count).str();
+}
+
+
+
+// char* merge_abi_callee_<name>(char* input), a clone of the callee entry
+// with get_arg_from_caller reading input and send_return_value_to_caller
+// setting the returned string
+Function* MergeCABIPass::createBridge(Module* M, Function* CalleeEntry) {
+  LLVMContext& Ctx = M->getContext();
+  PointerType* ptrTy = PointerType::get(Ctx, 0);
+  FunctionType* bridgeTy = FunctionType::get(ptrTy, {ptrTy}, false);
+  Function* bridge = Function::Create(bridgeTy, GlobalValue::InternalLinkage,
+                                      "merge_abi_callee_" + CalleeName_cabi, M);
+
+  ValueToValueMapTy VMap;
+  for (Argument& A : CalleeEntry->args())
+    VMap[&A] = Constant::getNullValue(A.getType());
+  SmallVector<ReturnInst*, 8> returns;
+  CloneFunctionInto(bridge, CalleeEntry, VMap, CloneFunctionChangeType::LocalChangesOnly, returns);
+  bridge->setCallingConv(CallingConv::C);
+  bridge->setAttributes(bridge->getAttributes().removeAttributesAtIndex(Ctx, AttributeList::ReturnIndex));
+  bridge->setLinkage(GlobalValue::InternalLinkage);
+  bridge->setVisibility(GlobalValue::DefaultVisibility);
+  bridge->setDSOLocal(true);
+  bridge->setComdat(nullptr);
+  Argument* input = bridge->getArg(0);
+  input->setName("input");
+
+  IRBuilder<> Builder(&*bridge->getEntryBlock().getFirstInsertionPt());
+  AllocaInst* output = Builder.CreateAlloca(ptrTy, nullptr, "output");
+  Builder.CreateStore(Constant::getNullValue(ptrTy), output);
+
+  std::vector<CallBase*> getArgs = findCallsTo(bridge, CalleeLang_cabi, "get_arg_from_caller");
+  std::vector<CallBase*> sends = findCallsTo(bridge, CalleeLang_cabi, "send_return_value_to_caller");
+  if (getArgs.empty() || sends.empty()) {
+    llvm::errs()<<"MergeCABI: callee_entry_"<<CalleeName_cabi
+                <<" doesn't call both get_arg_from_caller and send_return_value_to_caller\n";
+    bridge->eraseFromParent();
+    return nullptr;
+  }
+
+  // the bridge owns input: a single rust/swift get_arg_from_caller takes it
+  // over, anything else reads a copy or borrows it until the bridge returns
+  bool handOver = getArgs.size() == 1 && CalleeLang_cabi != "c";
+  for (CallBase* getArg : getArgs) {
+    Builder.SetInsertPoint(getArg);
+    Value* rustOut = CalleeLang_cabi == "rust" ? getArg->getArgOperand(0) : nullptr;
+    Value* cstr = input;
+    if (!handOver && CalleeLang_cabi != "c") cstr = Builder.CreateCall(getStrdup(M), {input});
+    Value* arg = createFromC(Builder, CalleeLang_cabi, cstr, rustOut, getArg->getType());
+    if (arg && !getArg->getType()->isVoidTy()) getArg->replaceAllUsesWith(arg);
+    eraseCall(getArg);
+  }
+  for (CallBase* send : sends) {
+    Builder.SetInsertPoint(send);
+    Builder.CreateStore(createToC(Builder, CalleeLang_cabi, send, 0), output);
+    eraseCall(send);
+  }
+  for (ReturnInst* ret : returns) {
+    Builder.SetInsertPoint(ret);
+    if (!handOver) Builder.CreateCall(getFree(M), {input});
+    Builder.CreateRet(Builder.CreateLoad(ptrTy, output));
+    ret->eraseFromParent();
+  }
+  return bridge;
+}
+
+
+
+// the string argument of Call starting at ArgNo as a malloc'ed C string,
+// consuming it when the language passes ownership
+Value* MergeCABIPass::createToC(IRBuilder<>& Builder, StringRef Lang, CallBase* Call, unsigned ArgNo) {
+  Module* M = Call->getModule();
+  PointerType* ptrTy = PointerType::get(M->getContext(), 0);
+  if (Lang == "rust") {
+    FunctionCallee toC = M->getOrInsertFunction("merge_abi_rust_to_c", ptrTy, ptrTy);
+    return Builder.CreateCall(toC, {Call->getArgOperand(ArgNo)});
+  }
+  if (Lang == "swift") {
+    // a swift String is passed as two words
+    Value* count = Call->getArgOperand(ArgNo);
+    Value* object = Call->getArgOperand(ArgNo + 1);
+    FunctionCallee toC = M->getOrInsertFunction("merge_abi_swift_to_c", ptrTy,
+                                                count->getType(), object->getType());
+    cast<Function>(toC.getCallee())->setCallingConv(CallingConv::Swift);
+    CallInst* call = Builder.CreateCall(toC, {count, object});
+    call->setCallingConv(CallingConv::Swift);
+    return call;
+  }
+  return Builder.CreateCall(getStrdup(M), {Call->getArgOperand(ArgNo)});
+}
+
+
+
+// CStr converted to the language's string, taking ownership of CStr. rust
+// writes the String to RustOut and returns nothing, swift returns SwiftTy
+Value* MergeCABIPass::createFromC(IRBuilder<>& Builder, StringRef Lang, Value* CStr, Value* RustOut, Type* SwiftTy) {
+  Module* M = Builder.GetInsertBlock()->getModule();
+  LLVMContext& Ctx = M->getContext();
+  PointerType* ptrTy = PointerType::get(Ctx, 0);
+  if (Lang == "rust") {
+    FunctionCallee fromC = M->getOrInsertFunction("merge_abi_rust_from_c", Type::getVoidTy(Ctx), ptrTy, ptrTy);
+    Builder.CreateCall(fromC, {RustOut, CStr});
+    return nullptr;
+  }
+  if (Lang == "swift") {
+    FunctionCallee fromC = M->getOrInsertFunction("merge_abi_swift_from_c", SwiftTy, ptrTy);
+    cast<Function>(fromC.getCallee())->setCallingConv(CallingConv::Swift);
+    CallInst* call = Builder.CreateCall(fromC, {CStr});
+    call->setCallingConv(CallingConv::Swift);
+    return call;
+  }
+  return CStr;
+}
+
+
+
+bool MergeCABIPass::bridgeRPC(CallBase* RPC, Function* Bridge) {
+  IRBuilder<> Builder(RPC);
+  Value* input = nullptr;
+  if (CallerLang_cabi == "c") input = createToC(Builder, "c", RPC, 1);
+  else if (CallerLang_cabi == "rust") input = createToC(Builder, "rust", RPC, 3);
+  else input = createToC(Builder, "swift", RPC, 2);
+  // the bridge takes input and hands back a string the caller owns
+  Value* output = Builder.CreateCall(Bridge, {input});
+
+  if (CallerLang_cabi == "c") {
+    // int make_rpc(char* name, char* input, char** output)
+    Builder.CreateStore(output, RPC->getArgOperand(2));
+    if (!RPC->getType()->isVoidTy())
+      RPC->replaceAllUsesWith(Constant::getNullValue(RPC->getType()));
+  }
+  else if (CallerLang_cabi == "rust") {
+    createFromC(Builder, "rust", output, RPC->getArgOperand(0), nullptr);
+  }
+  else {
+    RPC->replaceAllUsesWith(createFromC(Builder, "swift", output, nullptr, RPC->getType()));
+  }
+  eraseCall(RPC);
+  return true;
+}
+
+
+
+FunctionCallee MergeCABIPass::getStrdup(Module* M) {
+  PointerType* ptrTy = PointerType::get(M->getContext(), 0);
+  return M->getOrInsertFunction("strdup", ptrTy, ptrTy);
+}
+
+
+
+FunctionCallee MergeCABIPass::getFree(Module* M) {
+  LLVMContext& Ctx = M->getContext();
+  return M->getOrInsertFunction("free", Type::getVoidTy(Ctx), PointerType::get(Ctx, 0));
+}
+
+
+
+// an invoke falls through to its normal destination
+void MergeCABIPass::eraseCall(CallBase* Call) {
+  if (InvokeInst* invoke = dyn_cast<InvokeInst>(Call)) {
+    BranchInst::Create(invoke->getNormalDest(), invoke);
+    invoke->getUnwindDest()->removePredecessor(invoke->getParent());
+  }
+  Call->eraseFromParent();
+}
@@ -0,0 +1,75 @@
+//===-- MergeCABI.h - Transformations ---------------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_UTILS_MERGECABI_H
+#define LLVM_TRANSFORMS_UTILS_MERGECABI_H
+
+#include "llvm/IR/PassManager.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+#include "llvm/Transforms/Utils/MergeSymbolIndex.h"
+#include "llvm/Transforms/Utils/MergeStats.h"
+#include "llvm/Transforms/Utils/SwiftDemangle.h"
+#include <map>
+#include <string>
+#include <vector>
+
+namespace llvm {
+
+// merges a callee into its caller across languages (c, rust, swift) by
+// generating the C ABI bridge in IR instead of linking a hand-written
+// wrapper module per pair. The bridge is
+//   char* merge_abi_callee_<name>(char* input)
+// cloned from the callee function that calls get_arg_from_caller. Every
+// string crossing it is a malloc'ed C string owned by the receiver; the
+// rust/swift sides convert with the helpers in merge-c-abi/abi, which are
+// compiled once per language, not once per edge.
+class MergeCABIPass : public PassInfoMixin<MergeCABIPass> {
+public:
+  PreservedAnalyses run(Module &M, ModuleAnalysisManager &AM);
+
+private:
+  void renameCallee(Module* M);
+  void mergeCallee(Module* M);
+
+  std::string getName(Function* F, StringRef Lang);
+  bool isLangFunc(Function* F, StringRef Lang, StringRef BaseName);
+  Function* getCalleeEntry(Module* M);
+  std::vector<CallBase*> findCallsTo(Function* F, StringRef Lang, StringRef BaseName);
+  bool findRPCs(Module* M, Function* Bridge, std::vector<CallBase*>& RPCs);
+  bool isRPCToCallee(CallBase* RPC);
+  std::string getSwiftRPCCalleeName(CallBase* RPC);
+
+  Function* createBridge(Module* M, Function* CalleeEntry);
+  Value* createToC(IRBuilder<>& Builder, StringRef Lang, CallBase* Call, unsigned ArgNo);
+  Value* createFromC(IRBuilder<>& Builder, StringRef Lang, Value* CStr, Value* RustOut, Type* SwiftTy);
+  bool bridgeRPC(CallBase* RPC, Function* Bridge);
+  FunctionCallee getStrdup(Module* M);
+  FunctionCallee getFree(Module* M);
+  void eraseCall(CallBase* Call);
+
+  RustDemangleCache* RustDemangler = nullptr;
+  SwiftDemangleCache* SwiftDemangler = nullptr;
+  MergeSymbolIndex* Index = nullptr;
+  MergeStats* Stats = nullptr;
+};
+
+} // namespace llvm
+
+#endif // LLVM_TRANSFORMS_UTILS_MERGECABI_H
@@ -29,7 +29,10 @@ static cl::opt<bool> RenameCallee_cr(
 
 PreservedAnalyses MergeCRustFuncPass::run(Module &M,
                                       ModuleAnalysisManager &AM) {
+  MergeStats RunStats("merge-c-rust-func", M);
   if (MergeWrapperRust) {
+    RunStats.setMode("merge-wrapper-rust");
+    MergePhase Phase(RunStats, "clone");
     Function* wrapperFunc = findFuncByPrefix(M, "wrapper::callee_c_to_rust");
     if (!wrapperFunc) return PreservedAnalyses::all();
 
@@ -39,16 +42,19 @@ PreservedAnalyses MergeCRustFuncPass::run(Module &M,
     Function* CalleeFunc = M.getFunction("callee");
  
     Function* NewCalleeFunc = createRustNewCallee(CalleeFunc, dummyFuncCall); 
+    RunStats.addClonedFunc(NewCalleeFunc);
     deleteCalleeInputOutputFunc(NewCalleeFunc);
 
     Function* f1 = M.getFunction("main_callee_rust");
     Function* f2 = M.getFunction("_std_rt_lang_start_callee");
-    f1->eraseFromParent();
-    f2->eraseFromParent();
-    CalleeFunc->eraseFromParent();
+    RunStats.eraseFunction(f1);
+    RunStats.eraseFunction(f2);
+    RunStats.eraseFunction(CalleeFunc);
     
   }
   else if (MergeCWrapper) {
+    RunStats.setMode("merge-c-wrapper");
+    MergePhase Phase(RunStats, "replace-rpcs");
     Function* mainFunc = M.getFunction("main");
     CallInst* rpcInst = findCallByCalleePrefix(mainFunc, "make_rpc");
     if (!rpcInst) return PreservedAnalyses::all();
@@ -61,8 +67,11 @@ PreservedAnalyses MergeCRustFuncPass::run(Module &M,
     CallInst* newCall = CallInst::Create(wrapperFunc->getFunctionType(), wrapperFunc, arguments ,"", rpcInst);
     StoreInst *newStore = new StoreInst(newCall, rpcInst->getOperand(2), rpcInst);
     rpcInst->eraseFromParent();
+    RunStats.addMergedEdge(mainFunc->getName(), wrapperFunc->getName(), 1);
   }
   else if (DropRustDropTrait) {
+    RunStats.setMode("drop-rust-drop-trait");
+    MergePhase Phase(RunStats, "drop");
     Function* targetFunc = findFuncByPrefix(M, "wrapper::callee_c_to_rust");
     if (targetFunc==NULL) return PreservedAnalyses::all();
   
@@ -73,6 +82,8 @@ PreservedAnalyses MergeCRustFuncPass::run(Module &M,
   }
 
   else if (RenameCallee_cr) {
+    RunStats.setMode("rename-callee");
+    MergePhase Phase(RunStats, "rename");
     Function *mainFunc = M.getFunction("main");
     Function *rustRTFunc;
     for (Function::iterator BBB = mainFunc->begin(), BBE = mainFunc->end(); BBB != BBE; ++BBB){
@@ -27,6 +27,7 @@
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/Mangler.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/MergeStats.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/Demangle/Demangle.h"
 #include "llvm/Support/CommandLine.h"
@@ -28,3 +28,31 @@ func dummy(_ input: String) -> String {
   return output 
 }
 
+
+// -borrow-output-cs: the result is copied into the buffer of a BorrowSlot,
+// a thread-local global the pass creates per call site. The buffer is
+// allocated by the first call on a thread and grown when a result doesn't
+// fit, it lives as long as the thread. The pointer is valid until the call
+// site runs again on the same thread.
+struct BorrowSlot {
+  var buffer: UnsafeMutablePointer<CChar>?
+  var capacity: Int
+}
+
+func wrapper_c2swift_borrow(_ input: UnsafePointer<CChar>,
+                            _ slot: UnsafeMutablePointer<BorrowSlot>) -> UnsafePointer<CChar> {
+  let resultSwiftString = dummy(cCharPointerToSwiftString(input))
+  let size = resultSwiftString.utf8.count + 1
+  if slot.pointee.capacity < size {
+    guard let buffer = realloc(slot.pointee.buffer, size) else {
+      fatalError("Failed to allocate memory for the C string.")
+    }
+    slot.pointee.buffer = buffer.assumingMemoryBound(to: CChar.self)
+    slot.pointee.capacity = size
+  }
+  let buffer = slot.pointee.buffer!
+  resultSwiftString.withCString { cString in
+    _ = memcpy(buffer, cString, size)
+  }
+  return UnsafePointer<CChar>(buffer)
+}
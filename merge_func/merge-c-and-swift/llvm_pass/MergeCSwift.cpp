@@ -7,11 +7,15 @@
 //===----------------------------------------------------------------------===//
 
 #include "llvm/Transforms/Utils/MergeCSwift.h"
+#include "llvm/Analysis/CFG.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include <unistd.h>
-#include <sys/wait.h>
 
 using namespace llvm;
 
+#define DEBUG_TYPE "merge-c-swift"
+
 static cl::opt<bool> RenameCallee_cs(
                                      "rename-callee-cs", cl::init(false),
                                      cl::desc("rename the wrapper functions"));
@@ -24,17 +28,33 @@ static cl::opt<bool> MergeCallee_cs(
                                      "merge-callee-cs", cl::init(false),
                                      cl::desc("merge the given callee functions"));
 
+static cl::opt<bool> BorrowOutput_cs(
+                                     "borrow-output-cs", cl::init(false),
+                                     cl::desc("let the caller read the callee's swift String in place instead of a strdup'ed copy"));
+
 
 PreservedAnalyses MergeCSwiftPass::run(Module &M,
                                        ModuleAnalysisManager &AM) {
+  SwiftDemangler = &AM.getResult<SwiftDemangleAnalysis>(M);
+  MergeStats RunStats("merge-c-swift", M);
+  Stats = &RunStats;
   if (RenameCallee_cs) {
+    RunStats.setMode("rename-callee");
+    MergePhase Phase(RunStats, "rename");
     RenameCallee(&M);
+    return getRenamePreservedAnalyses();
   }
   else if (RenameWrapper_cs) {
+    RunStats.setMode("rename-wrapper");
+    MergePhase Phase(RunStats, "rename");
     RenameWrapper(&M);
+    return getRenamePreservedAnalyses();
   }
   else if (MergeCallee_cs) {
+    RunStats.setMode("merge-callee");
+    MergePhase Phase(RunStats, "merge");
     MergeCallee(&M);
+    return getMergePreservedAnalyses();
   }
   return PreservedAnalyses::all();
 }
@@ -52,9 +72,8 @@ void MergeCSwiftPass::RenameWrapper(Module* M) {
 void MergeCSwiftPass::MergeCallee(Module* M) {
   Function* callerFunc = M->getFunction("main");
   Function* rpcFunc = getCFunctionByDemangledName(M, "make_rpc(char const*, char*)");
-  Function* wrapperFunc = getSwiftFunctionByDemangledName(M, "wrapper.wrapper_c2swift(Swift.UnsafePointer<Swift.Int8>) -> Swift.UnsafePointer<Swift.Int8>");
-  if ((!callerFunc) || (!rpcFunc) || (!wrapperFunc)) {
-    llvm::errs()<<"cannot find caller function or make_rpc or wrapper function\n";
+  if ((!callerFunc) || (!rpcFunc)) {
+    llvm::errs()<<"cannot find caller function or make_rpc\n";
     return;
   }
   CallInst* rpcInst = getCallInstByCalledFunc(callerFunc, rpcFunc);
@@ -62,7 +81,19 @@ void MergeCSwiftPass::MergeCallee(Module* M) {
     llvm::errs()<<"caller doesn't contain make_rpc call\n";
     return;
   }
-  CallInst* callWrapper = createCallWrapper(rpcInst, wrapperFunc);
+  std::vector<CallInst*> outputFrees;
+  bool borrow = BorrowOutput_cs && canBorrowOutput(rpcInst, outputFrees);
+  if (BorrowOutput_cs && !borrow)
+    LLVM_DEBUG(dbgs()<<"MergeCSwift: the make_rpc output may outlive the next run of the call site, copying it\n");
+  Function* wrapperFunc = borrow
+    ? getSwiftFunctionByDemangledPrefix(M, "wrapper.wrapper_c2swift_borrow(")
+    : getSwiftFunctionByDemangledName(M, "wrapper.wrapper_c2swift(Swift.UnsafePointer<Swift.Int8>) -> Swift.UnsafePointer<Swift.Int8>");
+  if (!wrapperFunc) {
+    llvm::errs()<<"cannot find wrapper function\n";
+    return;
+  }
+  CallInst* callWrapper = borrow ? createBorrowCall(rpcInst, wrapperFunc, outputFrees)
+                                 : createCallWrapper(rpcInst, wrapperFunc);
   if (!callWrapper) {
     llvm::errs()<<"fail to create a call to wrapper\n";
   }
@@ -80,6 +111,8 @@ void MergeCSwiftPass::MergeCallee(Module* M) {
 
   Function* newCalleeFunc = createNewCalleeFunc(calleeFunc, dummyCall); 
   createCall2NewCallee(dummyCall, newCalleeFunc);
+  Stats->addClonedFunc(newCalleeFunc);
+  Stats->addMergedEdge(callerFunc->getName(), calleeFunc->getName(), 1);
 }
 
 Function* MergeCSwiftPass::getCFunctionByDemangledName(Module* M, std::string fname) {
@@ -95,51 +128,7 @@ Function* MergeCSwiftPass::getCFunctionByDemangledName(Module* M, std::string fn
 }
 
 std::string MergeCSwiftPass::getDemangledFunctionName(std::string mangledName) {
-  int pipe_to_child[2];   // Pipe for sending data to child (stdin)
-  int pipe_from_child[2]; // Pipe for receiving data from child (stdout)
-  char buffer[1024];
-  if (pipe(pipe_to_child) == -1 || pipe(pipe_from_child) == -1) {
-    perror("pipe");
-  }
-
-  pid_t pid = fork();
-  if (pid == -1) {
-    perror("fork");
-  } 
-  else if (pid == 0) {
-    // Child process
-    close(pipe_to_child[1]); 
-    close(pipe_from_child[0]);
-    // Redirect stdin to read from pipe_to_child
-    dup2(pipe_to_child[0], STDIN_FILENO);
-    close(pipe_to_child[0]); // Close the original descriptor
-    // Redirect stdout to write to pipe_from_child
-    dup2(pipe_from_child[1], STDOUT_FILENO);
-    close(pipe_from_child[1]); 
-
-    execlp("swift-demangle", "swift-demangle", nullptr);
-    perror("execlp"); 
-  } 
-  else {
-    // Parent process
-    close(pipe_to_child[0]); 
-    close(pipe_from_child[1]);
-
-    const char* input = mangledName.c_str();
-    write(pipe_to_child[1], input, strlen(input));
-    close(pipe_to_child[1]); // Close the write end to signal EOF
-    // Read output from the child process's stdout
-    ssize_t bytes_read;
-    while ((bytes_read = read(pipe_from_child[0], buffer, sizeof(buffer) - 1)) > 0) {
-      buffer[bytes_read-1] = '\0'; 
-    }
-    close(pipe_from_child[0]);
-
-    int status;
-    waitpid(pid, &status, 0);
-  }
-  std::string ret(buffer);
-  return ret;
+  return SwiftDemangler->getDemangledName(mangledName);
 }
 
 
@@ -156,18 +145,17 @@ Function* MergeCSwiftPass::getSwiftFunctionByDemangledName(Module* M, std::strin
 }
 
 
-CallInst* MergeCSwiftPass::getCallInstByCalledFunc(Function* callerFunc, Function* calledFunc) {
-  for (Function::iterator BBB = callerFunc->begin(), BBE = callerFunc->end(); BBB != BBE; ++BBB){
-    for (BasicBlock::iterator IB = BBB->begin(), IE = BBB->end(); IB != IE; IB++){
-      if (isa<CallInst>(IB)) {
-        CallInst* ci = dyn_cast<CallInst>(IB);
-        Function* func = ci->getCalledFunction();
-        if (func == calledFunc) 
-          return ci;
-      }
-    }
+Function* MergeCSwiftPass::getSwiftFunctionByDemangledPrefix(Module* M, std::string prefix) {
+  for (Function& F : *M) {
+    if (StringRef(getDemangledFunctionName(F.getName().str())).starts_with(prefix))
+      return &F;
   }
-  return NULL; 
+  return NULL;
+}
+
+
+CallInst* MergeCSwiftPass::getCallInstByCalledFunc(Function* callerFunc, Function* calledFunc) {
+  return getCallTo(callerFunc, calledFunc);
 }
 
 
@@ -264,21 +252,12 @@ Function* MergeCSwiftPass::createNewCalleeFunc(Function* calleeFunc, CallInst* d
   ReturnInst* newRet = ReturnInst::Create(newFunc->getContext(), dyn_cast<Value>(newRet2), ret); 
 
   ret->eraseFromParent();
-  sendReturnCall->eraseFromParent();
 
-  // need to delete swift_bridgeObjectRelease function call because it 
-  // deallocate the memory for the return swift string
-  CallInst* swiftBridgeObjectReleaseCall;
-  for (const llvm::Use &use : dyn_cast<Instruction>(sendReturnCallArg1)->uses()) {
-    User *user = use.getUser();
-    if (isa<CallInst>(user)) {
-      CallInst* ci = dyn_cast<CallInst>(user);
-      std::string calleeName = ci->getCalledFunction()->getName().str();
-      if (calleeName == "swift_bridgeObjectRelease")
-        swiftBridgeObjectReleaseCall = ci;
-    }
-  }
-  swiftBridgeObjectReleaseCall->eraseFromParent();
+  // send_return_value_to_caller borrows the string and the callee releases
+  // it afterwards, retain it so new_callee_func returns it at +1 like dummy
+  FunctionCallee retainFunc = getBridgeObjectRetain(M);
+  CallInst::Create(retainFunc, {sendReturnCallArg1}, "", sendReturnCall);
+  sendReturnCall->eraseFromParent();
 
   // change how the new callee function get arguments
   CallInst* getArgCall;
@@ -295,6 +274,9 @@ Function* MergeCSwiftPass::createNewCalleeFunc(Function* calleeFunc, CallInst* d
 
   Argument* arg1 = &*newFunc->arg_begin();
   Argument* arg2 = &*(std::next(newFunc->arg_begin(), 1));
+  // dummy's argument is borrowed but get_arg_from_caller returns an owned
+  // string the callee releases, so take a +1 of it
+  CallInst::Create(getBridgeObjectRetain(M), {arg2}, "", getArgCall);
   Value* newArg = UndefValue::get(getArgCall->getType());
   InsertValueInst* newInsertValue1 = InsertValueInst::Create(newArg, arg1, {0}, "new_arg1", getArgCall);
   InsertValueInst* newInsertValue2 = InsertValueInst::Create(dyn_cast<Value>(newInsertValue1), arg2, {1}, "new_arg2", getArgCall);
@@ -346,3 +328,113 @@ void MergeCSwiftPass::createCall2NewCallee(CallInst* dummyCall, Function* newCal
   }
   dummyCall->eraseFromParent();
 }
+
+
+
+FunctionCallee MergeCSwiftPass::getBridgeObjectRetain(Module* M) {
+  PointerType* ptrTy = PointerType::get(M->getContext(), 0);
+  return M->getOrInsertFunction("swift_bridgeObjectRetain", ptrTy, ptrTy);
+}
+
+
+
+// the free() calls on the make_rpc output, followed through the local
+// variables clang -O0 keeps it in. False if the output may get out of sight:
+// stored to other memory, returned, merged with other values, reallocated, or
+// kept in a variable that is reassigned or whose address is taken.
+static bool collectOutputFrees(Value* Output, std::vector<CallInst*>& Frees);
+
+static bool collectVariableFrees(AllocaInst* Var, Value* Output, std::vector<CallInst*>& Frees) {
+  for (User* U : Var->users()) {
+    if (LoadInst* LI = dyn_cast<LoadInst>(U)) {
+      if (!collectOutputFrees(LI, Frees)) return false;
+      continue;
+    }
+    StoreInst* SI = dyn_cast<StoreInst>(U);
+    if (SI && (SI->getValueOperand() == Output) && (SI->getPointerOperand() == Var)) continue;
+    IntrinsicInst* II = dyn_cast<IntrinsicInst>(U);
+    if (II && (II->isLifetimeStartOrEnd() || isa<DbgInfoIntrinsic>(II))) continue;
+    return false;
+  }
+  return true;
+}
+
+static bool collectOutputFrees(Value* Output, std::vector<CallInst*>& Frees) {
+  for (Use& U : Output->uses()) {
+    User* user = U.getUser();
+    if (isa<LoadInst>(user) || isa<ICmpInst>(user)) continue;
+    if (isa<GetElementPtrInst>(user) || isa<CastInst>(user)) {
+      if (!collectOutputFrees(user, Frees)) return false;
+      continue;
+    }
+    if (StoreInst* SI = dyn_cast<StoreInst>(user)) {
+      // writing into the buffer
+      if (U.getOperandNo() == SI->getPointerOperandIndex()) continue;
+      AllocaInst* var = dyn_cast<AllocaInst>(SI->getPointerOperand());
+      if (!var || !collectVariableFrees(var, Output, Frees)) return false;
+      continue;
+    }
+    if (CallBase* CB = dyn_cast<CallBase>(user)) {
+      Function* F = CB->getCalledFunction();
+      StringRef name = F ? F->getName() : "";
+      if ((name == "free") && isa<CallInst>(CB)) {
+        if (std::find(Frees.begin(), Frees.end(), CB) == Frees.end())
+          Frees.push_back(dyn_cast<CallInst>(CB));
+        continue;
+      }
+      if ((name == "free") || (name == "realloc") || !CB->isArgOperand(&U)) return false;
+      // other calls only read the output, see README
+      continue;
+    }
+    return false;
+  }
+  return true;
+}
+
+
+
+// -borrow-output-cs: every run of the call site overwrites the buffer of its
+// slot, so the make_rpc call can't sit in a loop or in a function calling
+// itself, and its output may only be freed where the pass can remove the free
+bool MergeCSwiftPass::canBorrowOutput(CallInst* rpcInst, std::vector<CallInst*>& Frees) {
+  BasicBlock* BB = rpcInst->getParent();
+  SmallVector<BasicBlock*, 4> succs(successors(BB));
+  if (!succs.empty() && isPotentiallyReachableFromMany(succs, BB, nullptr)) return false;
+  Function* callerFunc = rpcInst->getFunction();
+  for (User* U : callerFunc->users()) {
+    Instruction* I = dyn_cast<Instruction>(U);
+    if (I && (I->getFunction() == callerFunc)) return false;
+  }
+  return collectOutputFrees(rpcInst, Frees);
+}
+
+
+
+// -borrow-output-cs: the result is copied into the buffer of a thread-local
+// slot of the call site. The buffer outlives the caller and only grows, the
+// strdup per call is gone. The caller's free() calls on the output go away.
+CallInst* MergeCSwiftPass::createBorrowCall(CallInst* rpcInst, Function* wrapperFunc,
+                                            std::vector<CallInst*>& Frees) {
+  Module* M = rpcInst->getModule();
+
+  // BorrowSlot: the buffer and its capacity, nil and 0 until the first call
+  LLVMContext& Ctx = M->getContext();
+  ArrayType* slotTy = ArrayType::get(Type::getInt8Ty(Ctx), 16);
+  GlobalVariable* slot = new GlobalVariable(*M, slotTy, false, GlobalValue::InternalLinkage,
+                                            Constant::getNullValue(slotTy), "borrowed_output", nullptr,
+                                            GlobalValue::GeneralDynamicTLSModel);
+  slot->setAlignment(Align(8));
+
+  IRBuilder<> Builder(rpcInst);
+  Value* slotAddr = Builder.CreateThreadLocalAddress(slot);
+  CallInst* newCall = Builder.CreateCall(wrapperFunc, {rpcInst->getArgOperand(1), slotAddr}, "pointer2dummy");
+  newCall->setCallingConv(wrapperFunc->getCallingConv());
+
+  // the slot owns the output
+  for (CallInst* ci : Frees)
+    ci->eraseFromParent();
+
+  rpcInst->replaceAllUsesWith(newCall);
+  rpcInst->eraseFromParent();
+  return newCall;
+}
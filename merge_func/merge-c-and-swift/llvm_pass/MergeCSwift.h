@@ -31,6 +31,9 @@
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/Demangle/Demangle.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/SwiftDemangle.h"
+#include "llvm/Transforms/Utils/MergeSymbolIndex.h"
+#include "llvm/Transforms/Utils/MergeStats.h"
 #include <fstream>
 #include <sstream>
 #include <unistd.h>
@@ -46,13 +49,18 @@ public:
   std::string getDemangledFunctionName(std::string);
   Function* getSwiftFunctionByDemangledName(Module*, std::string);
   Function* getCFunctionByDemangledName(Module*, std::string);
+  Function* getSwiftFunctionByDemangledPrefix(Module*, std::string);
   CallInst* getCallInstByCalledFunc(Function*, Function*);
   CallInst* createCallWrapper(CallInst*, Function*); 
+  bool canBorrowOutput(CallInst*, std::vector<CallInst*>&);
+  CallInst* createBorrowCall(CallInst*, Function*, std::vector<CallInst*>&);
+  FunctionCallee getBridgeObjectRetain(Module*);
   Function* createNewCalleeFunc(Function*, CallInst*);
   void createCall2NewCallee(CallInst*, Function*);
 
 private:
-  std::string demangle_bin = "/proj/zyuxuanssf-PG0/zyuxuan/swift-6.0.3/usr/bin/swift-demangle";
+  SwiftDemangleCache* SwiftDemangler = nullptr;
+  MergeStats* Stats = nullptr;
 };
 
 } // namespace llvm
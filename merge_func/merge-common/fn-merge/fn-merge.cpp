@@ -0,0 +1,477 @@
+//===-- fn-merge.cpp - Merge a funcTree in memory -------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Does what `merge.sh rename_caller`, `rename_callee`, `merge_tree` and `link`
+// do with opt, llvm-link, llvm-split and llc, in one process: every bitcode
+// file of the funcTree is read once and the module stays in memory until the
+// object files are written.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/CodeGen/ParallelCG.h"
+#include "llvm/IR/DebugInfo.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+static cl::opt<std::string> FuncTree(cl::Positional, cl::Required,
+                                     cl::desc("<funcTree>"));
+
+static cl::opt<std::string> WorkDir(
+                                     "work-dir",
+                                     cl::desc("where cargo left the bitcode of each function"),
+                                     cl::init("debug/deps"));
+
+static cl::opt<std::string> OutputPrefix(
+                                     "o",
+                                     cl::desc("the object files are written to <prefix><N>.o"),
+                                     cl::init("function.part"));
+
+static cl::opt<unsigned> CodegenJobs(
+                                     "j",
+                                     cl::desc("object files to split the merged module into (0: one per core)"),
+                                     cl::init(0));
+
+static cl::opt<std::string> LinkPipeline(
+                                     "link-passes",
+                                     cl::desc("pipeline run on the linked module, as for `merge.sh link`"),
+                                     cl::init("strip-dead-prototypes,rust-dedup,remove-redundant,merge-post-opt,mergefunc"));
+
+static cl::opt<bool> LazyCrates(
+                                     "lazy-crates", cl::init(true),
+                                     cl::desc("only read the crate functions the merged module reaches"));
+
+// the merge passes are configured through their cl::opt flags, set them the
+// way `opt -<name>=<value>` would. The flag is reset first, each step of the
+// driver sets it again.
+static bool setPassOption(StringRef Name, StringRef Value) {
+  cl::Option* option = cl::getRegisteredOptions().lookup(Name);
+  if (!option) {
+    llvm::errs()<<"fn-merge Error: unknown option -"<<Name<<", is merge-rust-func built in?\n";
+    return false;
+  }
+  option->reset();
+  return !option->addOccurrence(1, Name, Value);
+}
+
+
+
+static bool runPipeline(Module &M, TargetMachine *TM, StringRef Pipeline) {
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+  PassBuilder PB(TM);
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  ModulePassManager MPM;
+  if (Error Err = PB.parsePassPipeline(MPM, Pipeline)) {
+    llvm::errs()<<"fn-merge Error: "<<toString(std::move(Err))<<"\n";
+    return false;
+  }
+  MPM.run(M, MAM);
+  return true;
+}
+
+
+
+// the funcTree lines are "<caller> <callee>", the first word is the entry
+// function (same format as merge_tree.py reads)
+static bool readFuncTree(std::string &Entry, std::vector<std::string> &Callees) {
+  auto buffer = MemoryBuffer::getFile(FuncTree);
+  if (!buffer) {
+    llvm::errs()<<"fn-merge Error: cannot read "<<FuncTree<<"\n";
+    return false;
+  }
+  SmallVector<StringRef, 16> lines;
+  (*buffer)->getBuffer().split(lines, '\n', -1, false);
+  for (StringRef line : lines) {
+    SmallVector<StringRef, 2> words;
+    line.split(words, ' ', -1, false);
+    for (StringRef word : words) {
+      std::string func = word.trim().str();
+      if (func.empty()) continue;
+      if (Entry.empty()) Entry = func;
+      else if ((func != Entry) && !is_contained(Callees, func)) Callees.push_back(func);
+    }
+  }
+  if (Entry.empty()) {
+    llvm::errs()<<"fn-merge Error: "<<FuncTree<<" has no edges\n";
+    return false;
+  }
+  return true;
+}
+
+
+
+// <func>/<work-dir>/function-<hash>.bc is the function's own module, the
+// other .bc files are the crates it was built with
+static std::string getFunctionIR(StringRef Func, std::map<std::string, std::string> &Deps) {
+  SmallString<128> dir(Func);
+  sys::path::append(dir, WorkDir);
+  std::string functionIR;
+  std::error_code EC;
+  for (sys::fs::directory_iterator it(dir, EC), end; it != end && !EC; it.increment(EC)) {
+    StringRef name = sys::path::filename(it->path());
+    if (!name.ends_with(".bc")) continue;
+    if (name.starts_with("function-") && (name.count('.') == 1)) functionIR = it->path();
+    // a crate the callees share is linked once, like `cp *.bc` in merge.sh
+    else Deps.insert({name.str(), it->path()});
+  }
+  if (functionIR.empty())
+    llvm::errs()<<"fn-merge Error: no function-*.bc in "<<dir<<"\n";
+  return functionIR;
+}
+
+
+
+static std::unique_ptr<Module> loadModule(StringRef Path, LLVMContext &Context) {
+  SMDiagnostic Err;
+  std::unique_ptr<Module> M = parseIRFile(Path, Err, Context);
+  if (!M) {
+    Err.print("fn-merge", llvm::errs());
+    return nullptr;
+  }
+  // merge.sh strips the debug info right after linking, do it before
+  StripDebugInfo(*M);
+  return M;
+}
+
+
+
+// a crate (std, serde, curl, ...) loaded lazily: its symbol table is read,
+// the function bodies stay in the bitcode until they are looked at
+struct LazyCrate {
+  std::string Path;
+  std::unique_ptr<MemoryBuffer> Buffer;
+  std::unique_ptr<Module> M;
+  // the linker brings the globals of a comdat in together
+  DenseMap<const Comdat*, std::vector<GlobalValue*>> ComdatMembers;
+  // the definitions the merged module needs from this crate
+  std::vector<GlobalValue*> Roots;
+  bool Needed = false;
+};
+
+
+
+static bool openCrate(LazyCrate &Crate, Module &Merged, LLVMContext &Context) {
+  auto buffer = MemoryBuffer::getFile(Crate.Path);
+  if (!buffer) {
+    llvm::errs()<<"fn-merge Error: cannot read "<<Crate.Path<<"\n";
+    return false;
+  }
+  Crate.Buffer = std::move(*buffer);
+  Expected<std::unique_ptr<Module>> M = getLazyBitcodeModule(Crate.Buffer->getMemBufferRef(), Context);
+  if (!M) {
+    llvm::errs()<<"fn-merge Error: "<<Crate.Path<<": "<<toString(M.takeError())<<"\n";
+    return false;
+  }
+  Crate.M = std::move(*M);
+  for (GlobalValue &GV : Crate.M->global_values()) {
+    if (const Comdat* C = GV.getComdat()) Crate.ComdatMembers[C].push_back(&GV);
+    // llc may emit calls to the `__*` builtins, remove-redundant keeps them
+    Function* F = dyn_cast<Function>(&GV);
+    if (F && !F->isDeclaration() && !F->hasLocalLinkage() && F->getName().starts_with("__") &&
+        !Merged.getNamedValue(F->getName()))
+      Merged.getOrInsertFunction(F->getName(), F->getFunctionType());
+  }
+  return true;
+}
+
+
+
+// the globals GV refers to: operands of its instructions, its initializer or
+// aliasee, its personality, prefix and prologue data. A function body is
+// read from the bitcode here.
+static Error collectReferences(GlobalValue &GV, std::vector<GlobalValue*> &Refs) {
+  SmallVector<Value*, 16> worklist;
+  if (Function* F = dyn_cast<Function>(&GV)) {
+    if (Error Err = F->materialize()) return Err;
+    if (F->hasPersonalityFn()) worklist.push_back(F->getPersonalityFn());
+    if (F->hasPrefixData()) worklist.push_back(F->getPrefixData());
+    if (F->hasPrologueData()) worklist.push_back(F->getPrologueData());
+    for (Instruction &I : instructions(F)) {
+      for (Value* op : I.operands())
+        if (isa<Constant>(op)) worklist.push_back(op);
+    }
+  }
+  else if (GlobalVariable* Var = dyn_cast<GlobalVariable>(&GV)) {
+    if (Var->hasInitializer()) worklist.push_back(Var->getInitializer());
+  }
+  else if (GlobalAlias* Alias = dyn_cast<GlobalAlias>(&GV)) {
+    worklist.push_back(Alias->getAliasee());
+  }
+  else if (GlobalIFunc* IFunc = dyn_cast<GlobalIFunc>(&GV)) {
+    worklist.push_back(IFunc->getResolver());
+  }
+
+  SmallPtrSet<Value*, 32> seen;
+  while (!worklist.empty()) {
+    Value* V = worklist.pop_back_val();
+    if (!seen.insert(V).second) continue;
+    if (GlobalValue* Ref = dyn_cast<GlobalValue>(V)) Refs.push_back(Ref);
+    else if (Constant* C = dyn_cast<Constant>(V)) {
+      for (Value* op : C->operands()) worklist.push_back(op);
+    }
+  }
+  return Error::success();
+}
+
+
+
+// a declaration of GV in M, its crate's link turns it into the definition
+static void declareIn(Module &M, GlobalValue &GV) {
+  if (M.getNamedValue(GV.getName())) return;
+  if (FunctionType* FTy = dyn_cast<FunctionType>(GV.getValueType()))
+    Function::Create(FTy, GlobalValue::ExternalLinkage, GV.getName(), M);
+  else
+    new GlobalVariable(M, GV.getValueType(), false, GlobalValue::ExternalLinkage, nullptr, GV.getName());
+}
+
+
+
+// link only what the merged module reaches, and each crate once: linking a
+// crate again would copy its internal globals a second time (std's stdout
+// lock, OnceLocks, the panic count, ...). The symbol tables and the bodies
+// reached are walked first, across the crates until nothing new is reached.
+// A name is provided by the first crate defining it. Then every name needed
+// from a crate is declared in the merged module, and the crate is linked
+// with LinkOnlyNeeded, which brings in those definitions and what they reach
+// inside the crate.
+static bool linkNeededCrates(Linker &L, Module &Merged, std::map<std::string, std::string> &Deps,
+                             LLVMContext &Context) {
+  std::vector<LazyCrate> crates(Deps.size());
+  unsigned i = 0;
+  for (auto &dep : Deps) {
+    crates[i].Path = dep.second;
+    if (!openCrate(crates[i++], Merged, Context)) return false;
+  }
+  StringMap<std::pair<LazyCrate*, GlobalValue*>> defs;
+  for (LazyCrate &crate : crates) {
+    for (GlobalValue &GV : crate.M->global_values()) {
+      if (!GV.isDeclaration() && !GV.hasLocalLinkage() && !GV.hasAppendingLinkage())
+        defs.insert({GV.getName(), {&crate, &GV}});
+    }
+  }
+
+  std::vector<std::pair<LazyCrate*, GlobalValue*>> worklist;
+  SmallPtrSet<GlobalValue*, 32> visited;
+  auto visit = [&](LazyCrate* Crate, GlobalValue* GV) {
+    if (!visited.insert(GV).second) return;
+    worklist.push_back({Crate, GV});
+    if (const Comdat* C = GV->getComdat()) {
+      for (GlobalValue* member : Crate->ComdatMembers[C])
+        if (visited.insert(member).second) worklist.push_back({Crate, member});
+    }
+  };
+  // a name the merged module has no definition for
+  auto need = [&](StringRef Name) {
+    GlobalValue* dst = Merged.getNamedValue(Name);
+    if (dst && !dst->isDeclaration()) return;
+    auto it = defs.find(Name);
+    if (it == defs.end() || visited.count(it->second.second)) return;
+    it->second.first->Needed = true;
+    it->second.first->Roots.push_back(it->second.second);
+    visit(it->second.first, it->second.second);
+  };
+
+  for (GlobalValue &GV : Merged.global_values()) {
+    if (GV.isDeclaration() && !GV.hasLocalLinkage() && GV.hasName()) need(GV.getName());
+  }
+  // appending arrays (llvm.global_ctors, llvm.used) are linked with every
+  // crate and remove-redundant keeps what they point to
+  for (LazyCrate &crate : crates) {
+    for (GlobalVariable &GV : crate.M->globals()) {
+      if (!GV.hasAppendingLinkage()) continue;
+      crate.Needed = true;
+      visit(&crate, &GV);
+    }
+  }
+  while (!worklist.empty()) {
+    auto [crate, GV] = worklist.back();
+    worklist.pop_back();
+    std::vector<GlobalValue*> refs;
+    if (Error Err = collectReferences(*GV, refs)) {
+      llvm::errs()<<"fn-merge Error: "<<crate->Path<<": "<<toString(std::move(Err))<<"\n";
+      return false;
+    }
+    for (GlobalValue* ref : refs) {
+      if (ref->isDeclaration()) need(ref->getName());
+      // the linker maps it to the merged module's definition
+      else if (!ref->hasLocalLinkage() && Merged.getNamedValue(ref->getName()) &&
+               !Merged.getNamedValue(ref->getName())->isDeclaration()) continue;
+      else visit(crate, ref);
+    }
+  }
+
+  for (LazyCrate &crate : crates) {
+    for (GlobalValue* GV : crate.Roots) declareIn(Merged, *GV);
+  }
+  for (LazyCrate &crate : crates) {
+    if (!crate.Needed) continue;
+    if (L.linkInModule(std::move(crate.M), Linker::Flags::LinkOnlyNeeded)) {
+      llvm::errs()<<"fn-merge Error: cannot link "<<crate.Path<<"\n";
+      return false;
+    }
+  }
+  // the crate bodies come in with their debug info
+  StripDebugInfo(Merged);
+  return true;
+}
+
+
+
+static std::unique_ptr<TargetMachine> createTargetMachine(StringRef TargetTriple) {
+  std::string error;
+  const Target* target = TargetRegistry::lookupTarget(TargetTriple, error);
+  if (!target) {
+    llvm::errs()<<"fn-merge Error: "<<error<<"\n";
+    return nullptr;
+  }
+  // llc -O3 --function-sections --data-sections
+  TargetOptions options;
+  options.FunctionSections = true;
+  options.DataSections = true;
+  return std::unique_ptr<TargetMachine>(target->createTargetMachine(
+      TargetTriple, "", "", options, std::nullopt, std::nullopt, CodeGenOptLevel::Aggressive));
+}
+
+
+
+// split the module and emit the parts on CodegenJobs threads, like the
+// llvm-split + parallel llc of `merge.sh codegen`
+static bool emitObjects(Module &M, StringRef TargetTriple) {
+  unsigned jobs = CodegenJobs ? (unsigned)CodegenJobs
+                              : heavyweight_hardware_concurrency().compute_thread_count();
+  std::vector<std::unique_ptr<ToolOutputFile>> outputs;
+  std::vector<raw_pwrite_stream*> streams;
+  for (unsigned i = 0; i < jobs; i++) {
+    std::error_code EC;
+    std::string path = OutputPrefix + std::to_string(i) + ".o";
+    outputs.push_back(std::make_unique<ToolOutputFile>(path, EC, sys::fs::OF_None));
+    if (EC) {
+      llvm::errs()<<"fn-merge Error: cannot write "<<path<<": "<<EC.message()<<"\n";
+      return false;
+    }
+    streams.push_back(&outputs.back()->os());
+  }
+  std::string triple = TargetTriple.str();
+  splitCodeGen(M, streams, {}, [&]() { return createTargetMachine(triple); },
+               CodeGenFileType::ObjectFile);
+  for (auto &output : outputs)
+    output->keep();
+  return true;
+}
+
+
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  InitializeAllTargets();
+  InitializeAllTargetMCs();
+  InitializeAllAsmPrinters();
+  InitializeAllAsmParsers();
+  cl::ParseCommandLineOptions(argc, argv,
+                              "merge the functions of a funcTree and emit the object files\n\n"
+                              "  The merge-rust-func flags (-call-freq-rr, -merge-size-budget-rr, ...)\n"
+                              "  and -merge-stats-json are accepted as with opt.\n");
+
+  std::string entry;
+  std::vector<std::string> callees;
+  if (!readFuncTree(entry, callees)) return 1;
+
+  LLVMContext Context;
+  std::map<std::string, std::string> deps;
+  std::string entryIR = getFunctionIR(entry, deps);
+  if (entryIR.empty()) return 1;
+  std::unique_ptr<Module> merged = loadModule(entryIR, Context);
+  if (!merged) return 1;
+  std::unique_ptr<TargetMachine> TM = createTargetMachine(merged->getTargetTriple());
+  if (!TM) return 1;
+
+  // rename_caller
+  if (!setPassOption("caller-name-rr", entry) || !setPassOption("rename-caller-rr", "true") ||
+      !runPipeline(*merged, TM.get(), "merge-rust-func") ||
+      !setPassOption("rename-caller-rr", "false"))
+    return 1;
+
+  // rename_callee on each callee, then link it next to the caller
+  Linker linker(*merged);
+  for (std::string &callee : callees) {
+    std::string calleeIR = getFunctionIR(callee, deps);
+    if (calleeIR.empty()) return 1;
+    std::unique_ptr<Module> M = loadModule(calleeIR, Context);
+    if (!M) return 1;
+    if (!setPassOption("callee-name-rr", callee) || !setPassOption("rename-callee-rr", "true") ||
+        !runPipeline(*M, TM.get(), "merge-rust-func") ||
+        !setPassOption("rename-callee-rr", "false"))
+      return 1;
+    if (linker.linkInModule(std::move(M))) {
+      llvm::errs()<<"fn-merge Error: cannot link "<<calleeIR<<"\n";
+      return 1;
+    }
+  }
+
+  // merge_tree
+  if (!setPassOption("func-tree-rr", FuncTree) || !setPassOption("merge-tree-rr", "true") ||
+      !runPipeline(*merged, TM.get(), "merge-rust-func") ||
+      !setPassOption("merge-tree-rr", "false"))
+    return 1;
+
+  // link: the crates of every function, then the same pipeline as merge.sh
+  if (LazyCrates) {
+    if (!linkNeededCrates(linker, *merged, deps, Context)) return 1;
+  }
+  else {
+    for (auto &dep : deps) {
+      std::unique_ptr<Module> M = loadModule(dep.second, Context);
+      if (!M) return 1;
+      if (linker.linkInModule(std::move(M))) {
+        llvm::errs()<<"fn-merge Error: cannot link "<<dep.second<<"\n";
+        return 1;
+      }
+    }
+  }
+  if (!runPipeline(*merged, TM.get(), LinkPipeline)) return 1;
+  if (verifyModule(*merged, &llvm::errs())) {
+    llvm::errs()<<"fn-merge Error: the merged module is broken\n";
+    return 1;
+  }
+
+  return emitObjects(*merged, merged->getTargetTriple()) ? 0 : 1;
+}
@@ -0,0 +1,73 @@
+//===-- MergeCallSites.h - Transformations ----------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_UTILS_MERGECALLSITES_H
+#define LLVM_TRANSFORMS_UTILS_MERGECALLSITES_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/Instructions.h"
+#include <vector>
+
+namespace llvm {
+
+// call-site lookups through the callee's use-list. Header only and without
+// analyses, so a pass outside merge-common (gollvm) only copies this file.
+
+// the calls of Callee (in Caller, if given), taken from Callee's use-list.
+// A use as an argument or a stored pointer is not a call of Callee.
+inline void addCallsTo(Function* Callee, Function* Caller, std::vector<CallBase*>& Calls) {
+  for (User* U : Callee->users()) {
+    CallBase* CB = dyn_cast<CallBase>(U);
+    if (CB && CB->getCalledFunction() == Callee && (!Caller || CB->getFunction() == Caller))
+      Calls.push_back(CB);
+  }
+}
+
+// use-lists are in no particular order, sort the calls of one function as
+// they appear in it. Only the blocks are walked, the calls in a block are
+// ordered with comesBefore().
+inline void sortInProgramOrder(std::vector<CallBase*>& Calls) {
+  if (Calls.size() < 2) return;
+  DenseMap<const BasicBlock*, unsigned> blockOrder;
+  unsigned n = 0;
+  for (BasicBlock &BB : *Calls[0]->getFunction())
+    blockOrder[&BB] = n++;
+  llvm::sort(Calls, [&](CallBase* A, CallBase* B) {
+    if (A->getParent() != B->getParent())
+      return blockOrder[A->getParent()] < blockOrder[B->getParent()];
+    return A->comesBefore(B);
+  });
+}
+
+// the first call / invoke of Callee in Caller in program order
+template <typename CallTy>
+CallTy* getFirstCallTo(Function* Caller, Function* Callee) {
+  if (!Caller || !Callee) return NULL;
+  std::vector<CallBase*> calls;
+  addCallsTo(Callee, Caller, calls);
+  sortInProgramOrder(calls);
+  for (CallBase* CB : calls) {
+    if (isa<CallTy>(CB)) return dyn_cast<CallTy>(CB);
+  }
+  return NULL;
+}
+
+inline CallInst* getCallTo(Function* Caller, Function* Callee) {
+  return getFirstCallTo<CallInst>(Caller, Callee);
+}
+
+inline InvokeInst* getInvokeTo(Function* Caller, Function* Callee) {
+  return getFirstCallTo<InvokeInst>(Caller, Callee);
+}
+
+} // namespace llvm
+
+#endif // LLVM_TRANSFORMS_UTILS_MERGECALLSITES_H
@@ -0,0 +1,206 @@
+//===-- MergePlanner.cpp - Transformations --------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Utils/MergePlanner.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <optional>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "merge-planner"
+
+static std::optional<json::Value> readJSON(StringRef Path) {
+  auto buffer = MemoryBuffer::getFile(Path);
+  if (!buffer) {
+    llvm::errs()<<"MergePlanner Error: cannot read "<<Path<<"\n";
+    return std::nullopt;
+  }
+  Expected<json::Value> value = json::parse((*buffer)->getBuffer());
+  if (!value) {
+    llvm::errs()<<"MergePlanner Error: "<<Path<<": "<<toString(value.takeError())<<"\n";
+    return std::nullopt;
+  }
+  return std::move(*value);
+}
+
+
+
+static uint64_t getUInt(const json::Value& V) {
+  if (auto i = V.getAsInteger()) return *i < 0 ? 0 : *i;
+  if (auto d = V.getAsNumber()) return *d < 0 ? 0 : (uint64_t)*d;
+  return 0;
+}
+
+
+
+bool MergePlanner::loadCallFreq(StringRef Path) {
+  auto value = readJSON(Path);
+  if (!value) return false;
+  const json::Object* callers = value->getAsObject();
+  if (!callers) {
+    llvm::errs()<<"MergePlanner Error: "<<Path<<" is not a {caller: {callee: count}} map\n";
+    return false;
+  }
+  for (auto &caller : *callers) {
+    const json::Object* callees = caller.second.getAsObject();
+    if (!callees) continue;
+    for (auto &callee : *callees)
+      CallFreq[caller.first.str()][callee.first.str()] += getUInt(callee.second);
+  }
+  return true;
+}
+
+
+
+bool MergePlanner::loadCPUUsage(StringRef Path) {
+  auto value = readJSON(Path);
+  if (!value) return false;
+  const json::Object* funcs = value->getAsObject();
+  if (!funcs) {
+    llvm::errs()<<"MergePlanner Error: "<<Path<<" is not a {func: cpu} map\n";
+    return false;
+  }
+  for (auto &func : *funcs)
+    CPUUsage[func.first.str()] = getUInt(func.second);
+  return true;
+}
+
+
+
+// without frequency data every edge counts as called once
+uint64_t MergePlanner::getFreq(const Edge& E) {
+  if (CallFreq.empty()) return 1;
+  auto caller = CallFreq.find(E.first);
+  if (caller == CallFreq.end()) return 0;
+  auto callee = caller->second.find(E.second);
+  if (callee == caller->second.end()) return 0;
+  return callee->second;
+}
+
+
+
+// walk the defined functions reachable from the node, calling fn on the
+// ones that are not part of the fused binary yet
+template <typename CallbackT>
+static void forEachNewFunction(Function* Root, SmallPtrSetImpl<Function*>& Included,
+                               CallbackT fn) {
+  SmallPtrSet<Function*, 32> visited;
+  std::vector<Function*> worklist;
+  if (Root) worklist.push_back(Root);
+  while (!worklist.empty()) {
+    Function* F = worklist.back();
+    worklist.pop_back();
+    if (F->isDeclaration() || Included.count(F) || !visited.insert(F).second)
+      continue;
+    fn(F);
+    for (BasicBlock &BB : *F) {
+      for (Instruction &I : BB) {
+        for (Value* op : I.operands()) {
+          if (Function* callee = dyn_cast<Function>(op->stripPointerCasts()))
+            worklist.push_back(callee);
+        }
+      }
+    }
+  }
+}
+
+
+
+uint64_t MergePlanner::getAddedSize(StringRef Name) {
+  uint64_t size = 0;
+  forEachNewFunction(Functions.lookup(Name), Included,
+                     [&](Function* F) { size += F->getInstructionCount(); });
+  return size;
+}
+
+
+
+void MergePlanner::include(StringRef Name) {
+  Fused.insert(Name);
+  std::vector<Function*> added;
+  forEachNewFunction(Functions.lookup(Name), Included,
+                     [&](Function* F) { added.push_back(F); });
+  Included.insert(added.begin(), added.end());
+}
+
+
+
+std::vector<MergePlanner::Edge> MergePlanner::plan(StringRef Entry,
+                                                   const std::vector<Edge>& Edges,
+                                                   uint64_t SizeBudget, uint64_t MinFreq,
+                                                   uint64_t MaxCalleeCPU) {
+  Fused.clear();
+  Included.clear();
+  include(Entry);
+
+  uint64_t size = 0;
+  StringSet<> rejected;
+  while (true) {
+    // best frequency per added instruction among the edges leaving the fused binary
+    const Edge* best = nullptr;
+    uint64_t bestFreq = 0, bestSize = 0;
+    for (const Edge& E : Edges) {
+      if (!Fused.count(E.first) || Fused.count(E.second) || rejected.count(E.second))
+        continue;
+      uint64_t freq = getFreq(E);
+      if (freq < MinFreq || freq == 0) continue;
+      if (MaxCalleeCPU && CPUUsage.lookup(E.second) > MaxCalleeCPU) {
+        rejected.insert(E.second);
+        continue;
+      }
+      uint64_t added = getAddedSize(E.second);
+      // freq / added > bestFreq / bestSize
+      if (!best || freq * bestSize > bestFreq * added) {
+        best = &E;
+        bestFreq = freq;
+        bestSize = added;
+      }
+    }
+    if (!best) break;
+    if (SizeBudget && size + bestSize > SizeBudget) {
+      rejected.insert(best->second);
+      continue;
+    }
+    LLVM_DEBUG(dbgs()<<"MergePlanner: fuse "<<best->first<<" -> "<<best->second
+                    <<" (freq "<<bestFreq<<", +"<<bestSize<<" insts)\n");
+    size += bestSize;
+    include(best->second);
+  }
+
+  // every edge between fused functions loses its hop, a callee is cloned by
+  // its first edge whose caller is already there
+  std::vector<Edge> plan;
+  std::vector<bool> done(Edges.size(), false);
+  StringSet<> ready;
+  ready.insert(Entry);
+  bool progress = true;
+  while (progress) {
+    progress = false;
+    for (unsigned i = 0; i < Edges.size(); i++) {
+      const Edge& E = Edges[i];
+      if (done[i] || !Fused.count(E.first) || !Fused.count(E.second) || !ready.count(E.first))
+        continue;
+      plan.push_back(E);
+      ready.insert(E.second);
+      done[i] = true;
+      progress = true;
+    }
+  }
+  LLVM_DEBUG({
+    for (const Edge& E : Edges) {
+      if (!Fused.count(E.first) || !Fused.count(E.second))
+        dbgs()<<"MergePlanner: keep RPC "<<E.first<<" -> "<<E.second<<"\n";
+    }
+  });
+  return plan;
+}
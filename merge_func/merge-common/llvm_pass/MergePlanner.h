@@ -0,0 +1,62 @@
+//===-- MergePlanner.h - Transformations ------------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_UTILS_MERGEPLANNER_H
+#define LLVM_TRANSFORMS_UTILS_MERGEPLANNER_H
+
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace llvm {
+
+// picks the RPC edges of a funcTree that are worth fusing. Edge weights come
+// from `callgraph_gen/call-freq.json` ({caller: {callee: count}}) and the
+// per-function cpu usage from `callgraph_gen/cpu-usage.json` ({func: millicores}).
+// Starting from the entry function, the planner greedily fuses the reachable
+// callee with the best frequency per added IR instruction until the size
+// budget is spent. Cold edges (below MinFreq) and busy callees (above
+// MaxCalleeCPU) stay behind their RPC.
+class MergePlanner {
+public:
+  typedef std::pair<std::string, std::string> Edge;
+
+  bool loadCallFreq(StringRef Path);
+  bool loadCPUUsage(StringRef Path);
+  // the function that holds the code of a funcTree node
+  void setFunction(StringRef Name, Function* F) { Functions[Name] = F; }
+
+  // the fused edges, ordered so that every caller is merged before its
+  // own edges. Size is counted in IR instructions, 0 means no budget.
+  std::vector<Edge> plan(StringRef Entry, const std::vector<Edge>& Edges,
+                         uint64_t SizeBudget, uint64_t MinFreq,
+                         uint64_t MaxCalleeCPU);
+  const StringSet<>& getFusedFunctions() { return Fused; }
+
+private:
+  uint64_t getFreq(const Edge& E);
+  uint64_t getAddedSize(StringRef Name);
+  void include(StringRef Name);
+
+  StringMap<StringMap<uint64_t>> CallFreq;
+  StringMap<uint64_t> CPUUsage;
+  StringMap<Function*> Functions;
+  StringSet<> Fused;
+  // defined functions already pulled into the fused binary
+  SmallPtrSet<Function*, 32> Included;
+};
+
+} // namespace llvm
+
+#endif // LLVM_TRANSFORMS_UTILS_MERGEPLANNER_H
@@ -0,0 +1,86 @@
+//===-- MergePostOpt.cpp - Transformations --------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Utils/MergePostOpt.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/CGSCCPassManager.h"
+#include "llvm/Analysis/InlineCost.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/IPO/FunctionAttrs.h"
+#include "llvm/Transforms/IPO/GlobalDCE.h"
+#include "llvm/Transforms/IPO/GlobalOpt.h"
+#include "llvm/Transforms/IPO/Inliner.h"
+#include "llvm/Transforms/IPO/SCCP.h"
+#include "llvm/Transforms/InstCombine/InstCombine.h"
+#include "llvm/Transforms/Scalar/ADCE.h"
+#include "llvm/Transforms/Scalar/DeadStoreElimination.h"
+#include "llvm/Transforms/Scalar/EarlyCSE.h"
+#include "llvm/Transforms/Scalar/GVN.h"
+#include "llvm/Transforms/Scalar/SROA.h"
+#include "llvm/Transforms/Scalar/SimplifyCFG.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "merge-post-opt"
+
+STATISTIC(NumCalleesHinted, "Number of merged callees internalized and hinted for inlining");
+
+PreservedAnalyses MergeCalleeHintPass::run(Module &M, ModuleAnalysisManager &AM) {
+  unsigned hinted = 0;
+  for (Function &F : M) {
+    if (F.isDeclaration() || !isMergedCallee(F)) continue;
+    // leave callees the user asked to keep out of line alone
+    if (F.hasFnAttribute(Attribute::NoInline) || F.hasFnAttribute(Attribute::OptimizeNone))
+      continue;
+    F.setLinkage(GlobalValue::InternalLinkage);
+    F.setDSOLocal(true);
+    F.addFnAttr(Attribute::InlineHint);
+    hinted++;
+  }
+  NumCalleesHinted += hinted;
+  return hinted ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
+
+
+
+bool MergeCalleeHintPass::isMergedCallee(const Function &F) {
+  StringRef name = F.getName();
+  return name.starts_with("NewCallee_") || name.starts_with("new_callee_") ||
+         name.starts_with("merge_abi_callee_");
+}
+
+
+
+ModulePassManager llvm::buildMergePostOptPipeline() {
+  ModulePassManager MPM;
+  MPM.addPass(MergeCalleeHintPass());
+  // constant arguments the caller passes now reach the callee body
+  MPM.addPass(IPSCCPPass());
+  MPM.addPass(GlobalOptPass());
+
+  FunctionPassManager FPM;
+  FPM.addPass(SROAPass(SROAOptions::ModifyCFG));
+  FPM.addPass(EarlyCSEPass(true));
+  FPM.addPass(InstCombinePass());
+  FPM.addPass(SimplifyCFGPass());
+  FPM.addPass(GVNPass());
+  FPM.addPass(DSEPass());
+  FPM.addPass(ADCEPass());
+  FPM.addPass(SimplifyCFGPass());
+
+  // the -O3 thresholds, inlinehint raises them for the merged callees
+  ModuleInlinerWrapperPass MIWP(getInlineParams(3, 0));
+  CGSCCPassManager &CGPM = MIWP.getPM();
+  CGPM.addPass(PostOrderFunctionAttrsPass());
+  CGPM.addPass(createCGSCCToFunctionPassAdaptor(std::move(FPM)));
+  MPM.addPass(std::move(MIWP));
+
+  MPM.addPass(GlobalOptPass());
+  MPM.addPass(GlobalDCEPass());
+  return MPM;
+}
@@ -0,0 +1,41 @@
+//===-- MergePostOpt.h - Transformations ------------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_UTILS_MERGEPOSTOPT_H
+#define LLVM_TRANSFORMS_UTILS_MERGEPOSTOPT_H
+
+#include "llvm/IR/PassManager.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+
+namespace llvm {
+
+// the merge passes leave every callee behind as an external function
+// (NewCallee_<name>, new_callee_<name>, merge_abi_callee_<name>) only reached
+// from the call that replaced its RPC. Nothing outside the fused binary can
+// call them, so this pass internalizes them and marks them inlinehint: the
+// inliner then folds them into their callers where the cost model agrees and
+// globaldce drops the bodies nobody calls anymore.
+class MergeCalleeHintPass : public PassInfoMixin<MergeCalleeHintPass> {
+public:
+  PreservedAnalyses run(Module &M, ModuleAnalysisManager &AM);
+
+private:
+  bool isMergedCallee(const Function &F);
+};
+
+// `merge-post-opt`: the interprocedural cleanup `merge.sh link` runs once the
+// RPCs are direct calls. It hints the merged callees, propagates constants
+// across the new call edges (ipsccp), inlines bottom-up with a function
+// simplification pipeline per SCC, and finishes with globalopt/globaldce so
+// the serialization code whose results became dead after inlining goes away.
+ModulePassManager buildMergePostOptPipeline();
+
+} // namespace llvm
+
+#endif // LLVM_TRANSFORMS_UTILS_MERGEPOSTOPT_H
@@ -0,0 +1,149 @@
+//===-- MergeStats.cpp - Transformations ----------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Utils/MergeStats.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "merge-stats"
+
+STATISTIC(NumRPCsReplaced, "Number of make_rpc calls replaced by direct calls");
+STATISTIC(NumEdgesMerged, "Number of caller -> callee edges merged");
+STATISTIC(NumFuncsCloned, "Number of functions cloned by the merge passes");
+STATISTIC(NumFuncsErased, "Number of functions erased by the merge passes");
+STATISTIC(NumInstsErased, "Number of IR instructions erased with those functions");
+STATISTIC(NumDemangleLookups, "Number of demangler lookups of the merge passes");
+STATISTIC(NumDemangled, "Number of symbols the merge passes had to demangle");
+
+static cl::opt<std::string> MergeStatsJSON(
+                                     "merge-stats-json", cl::Hidden,
+                                     cl::desc("append one JSON line per merge pass run to this file"),
+                                     cl::init(""));
+
+uint64_t MergeStats::TotalDemangleLookups = 0;
+uint64_t MergeStats::TotalDemangled = 0;
+
+MergeStats::MergeStats(StringRef PassName, Module &M)
+    : PassName(PassName.str()), ModuleName(M.getModuleIdentifier()), M(M),
+      InstsBefore(M.getInstructionCount()), DemangleLookups(TotalDemangleLookups),
+      Demangled(TotalDemangled), Start(std::chrono::steady_clock::now()) {}
+
+
+
+void MergeStats::addMergedEdge(StringRef Caller, StringRef Callee, unsigned RPCs) {
+  Edges.push_back({Caller.str(), Callee.str(), RPCs});
+  RPCsReplaced += RPCs;
+}
+
+
+
+void MergeStats::addClonedFunc(Function *F) {
+  FuncsCloned++;
+  InstsCloned += F->getInstructionCount();
+}
+
+
+
+void MergeStats::addErasedFunc(Function *F) {
+  FuncsErased++;
+  InstsErased += F->getInstructionCount();
+}
+
+
+
+void MergeStats::eraseFunction(Function *F) {
+  if (!F) return;
+  addErasedFunc(F);
+  F->eraseFromParent();
+}
+
+
+
+void MergeStats::addPhaseTime(StringRef Phase, double Seconds) {
+  for (auto &phase : Phases) {
+    if (phase.first == Phase) {
+      phase.second += Seconds;
+      return;
+    }
+  }
+  Phases.push_back({Phase.str(), Seconds});
+}
+
+
+
+// the record is written with a single append, so concurrent opt runs of
+// merge_tree.py can share one file
+MergeStats::~MergeStats() {
+  uint64_t lookups = TotalDemangleLookups - DemangleLookups;
+  uint64_t demangled = TotalDemangled - Demangled;
+  NumRPCsReplaced += RPCsReplaced;
+  NumEdgesMerged += Edges.size();
+  NumFuncsCloned += FuncsCloned;
+  NumFuncsErased += FuncsErased;
+  NumInstsErased += InstsErased;
+  NumDemangleLookups += lookups;
+  NumDemangled += demangled;
+  if (MergeStatsJSON.empty()) return;
+
+  json::Array edges;
+  for (auto &edge : Edges)
+    edges.push_back(json::Object{{"caller", edge.Caller}, {"callee", edge.Callee}, {"rpcs", edge.RPCs}});
+  json::Object phases;
+  for (auto &phase : Phases)
+    phases[phase.first] = phase.second;
+  std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - Start;
+  json::Object record{{"pass", PassName},
+                      {"mode", Mode},
+                      {"module", ModuleName},
+                      {"edges", std::move(edges)},
+                      {"rpcs_replaced", RPCsReplaced},
+                      {"funcs_cloned", FuncsCloned},
+                      {"funcs_erased", FuncsErased},
+                      {"insts_before", InstsBefore},
+                      {"insts_after", M.getInstructionCount()},
+                      {"insts_cloned", InstsCloned},
+                      {"insts_erased", InstsErased},
+                      {"demangle_lookups", lookups},
+                      {"demangled", demangled},
+                      {"phases", std::move(phases)},
+                      {"seconds", seconds.count()}};
+
+  std::string line;
+  raw_string_ostream OS(line);
+  OS<<json::Value(std::move(record))<<"\n";
+  std::error_code EC;
+  raw_fd_ostream file(MergeStatsJSON, EC, sys::fs::OF_Append | sys::fs::OF_Text);
+  if (EC) {
+    llvm::errs()<<"MergeStats Error: cannot open "<<MergeStatsJSON<<": "<<EC.message()<<"\n";
+    return;
+  }
+  file.SetUnbuffered();
+  file<<OS.str();
+}
+
+
+
+MergePhase::MergePhase(MergeStats &Stats, StringRef Name)
+    : Stats(Stats), Name(Name.str()),
+      Timer(Stats.getPassName().str() + "." + Name.str(),
+            Stats.getPassName().str() + ": " + Name.str(), "merge",
+            "Merge pass phases", TimePassesIsEnabled),
+      Start(std::chrono::steady_clock::now()) {}
+
+
+
+MergePhase::~MergePhase() {
+  std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - Start;
+  Stats.addPhaseTime(Name, seconds.count());
+}
@@ -0,0 +1,78 @@
+//===-- MergeStats.h - Transformations --------------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_UTILS_MERGESTATS_H
+#define LLVM_TRANSFORMS_UTILS_MERGESTATS_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Timer.h"
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace llvm {
+
+// what one run of a merge pass did. When the run ends the counters are added
+// to the `merge-stats` STATISTICs (-stats), and with -merge-stats-json=<file>
+// the run is appended to <file> as one JSON line (see merge_tree.py stats).
+class MergeStats {
+public:
+  MergeStats(StringRef PassName, Module &M);
+  ~MergeStats();
+  void setMode(StringRef RunMode) { Mode = RunMode.str(); }
+  // one caller -> callee edge whose make_rpc calls became direct calls
+  void addMergedEdge(StringRef Caller, StringRef Callee, unsigned RPCs);
+  void addClonedFunc(Function *F);
+  // count F as erased, call it before F's body goes away
+  void addErasedFunc(Function *F);
+  // erase F (if any) and count it
+  void eraseFunction(Function *F);
+  void addPhaseTime(StringRef Phase, double Seconds);
+  StringRef getPassName() { return PassName; }
+  // bumped by the demangle caches on every getDemangledName call and every
+  // symbol they demangle, so MergeStats doesn't depend on the demanglers
+  static uint64_t TotalDemangleLookups;
+  static uint64_t TotalDemangled;
+
+private:
+  struct Edge {
+    std::string Caller, Callee;
+    unsigned RPCs;
+  };
+
+  std::string PassName, Mode, ModuleName;
+  Module &M;
+  std::vector<Edge> Edges;
+  std::vector<std::pair<std::string, double>> Phases;
+  unsigned RPCsReplaced = 0, FuncsCloned = 0, FuncsErased = 0;
+  uint64_t InstsBefore, InstsCloned = 0, InstsErased = 0;
+  // the demangler counters of the process when the run started
+  uint64_t DemangleLookups, Demangled;
+  std::chrono::steady_clock::time_point Start;
+};
+
+// one phase of a merge pass run (rename, link, clone, ...). -time-passes
+// reports it in the "merge" timer group, and its wall time goes to the JSON
+// record of the run.
+class MergePhase {
+public:
+  MergePhase(MergeStats &Stats, StringRef Name);
+  ~MergePhase();
+
+private:
+  MergeStats &Stats;
+  std::string Name;
+  NamedRegionTimer Timer;
+  std::chrono::steady_clock::time_point Start;
+};
+
+} // namespace llvm
+
+#endif // LLVM_TRANSFORMS_UTILS_MERGESTATS_H
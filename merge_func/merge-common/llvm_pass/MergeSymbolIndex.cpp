@@ -0,0 +1,176 @@
+//===-- MergeSymbolIndex.cpp - Transformations ----------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Utils/MergeSymbolIndex.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/Transforms/Utils/SwiftDemangle.h"
+
+using namespace llvm;
+
+AnalysisKey MergeSymbolIndexAnalysis::Key;
+
+MergeSymbolIndex MergeSymbolIndexAnalysis::run(Module &M,
+                                               ModuleAnalysisManager &AM) {
+  return MergeSymbolIndex(M, AM.getResult<RustDemangleAnalysis>(M));
+}
+
+
+
+MergeSymbolIndex::MergeSymbolIndex(Module &M, RustDemangleCache &Demangler)
+    : Demangler(Demangler) {
+  for (Function &F : M)
+    addFunction(&F);
+}
+
+
+
+void MergeSymbolIndex::addFunction(Function* F) {
+  Functions[getDemangledName(F->getName())].push_back(WeakVH(F));
+}
+
+
+
+const std::string& MergeSymbolIndex::getDemangledName(StringRef MangledName) {
+  return Demangler.getDemangledName(MangledName);
+}
+
+
+
+// functions may have been renamed since they were indexed
+bool MergeSymbolIndex::isNamed(Function* F, StringRef DemangledName) {
+  return F && getDemangledName(F->getName()) == DemangledName;
+}
+
+
+
+Function* MergeSymbolIndex::getFunction(StringRef DemangledName) {
+  std::vector<Function*> funcs = getFunctions(DemangledName);
+  if (funcs.empty()) return NULL;
+  return funcs[0];
+}
+
+
+
+std::vector<Function*> MergeSymbolIndex::getFunctions(StringRef DemangledName) {
+  std::vector<Function*> funcs;
+  auto it = Functions.find(DemangledName);
+  if (it == Functions.end()) return funcs;
+  for (WeakVH &VH : it->second) {
+    Function* F = dyn_cast_or_null<Function>(VH);
+    if (isNamed(F, DemangledName)) funcs.push_back(F);
+  }
+  return funcs;
+}
+
+
+
+std::vector<CallBase*> MergeSymbolIndex::getCallSites(StringRef CalleeDemangledName) {
+  std::vector<CallBase*> calls;
+  for (Function* F : getFunctions(CalleeDemangledName))
+    addCallsTo(F, nullptr, calls);
+  return calls;
+}
+
+
+
+std::vector<CallBase*> MergeSymbolIndex::getCallSites(Function* Caller, StringRef CalleeDemangledName) {
+  std::vector<CallBase*> calls;
+  for (Function* F : getFunctions(CalleeDemangledName))
+    addCallsTo(F, Caller, calls);
+  sortInProgramOrder(calls);
+  return calls;
+}
+
+
+
+CallInst* MergeSymbolIndex::getCall(Function* Caller, StringRef CalleeDemangledName) {
+  for (CallBase* CB : getCallSites(Caller, CalleeDemangledName)) {
+    if (isa<CallInst>(CB)) return dyn_cast<CallInst>(CB);
+  }
+  return NULL;
+}
+
+
+
+InvokeInst* MergeSymbolIndex::getInvoke(Function* Caller, StringRef CalleeDemangledName) {
+  for (CallBase* CB : getCallSites(Caller, CalleeDemangledName)) {
+    if (isa<InvokeInst>(CB)) return dyn_cast<InvokeInst>(CB);
+  }
+  return NULL;
+}
+
+
+
+// the bytes of C from Offset on, looking into the fields of a struct (rustc
+// packs several constants into one allocation)
+static bool getConstantBytes(const Constant* C, uint64_t Offset, const DataLayout& DL, std::string& bytes) {
+  if (auto* CDS = dyn_cast<ConstantDataSequential>(C)) {
+    if (!CDS->isString()) return false;
+    StringRef data = CDS->getRawDataValues();
+    if (Offset > data.size()) return false;
+    bytes = data.substr(Offset).str();
+    return true;
+  }
+  if (auto* CS = dyn_cast<ConstantStruct>(C)) {
+    const StructLayout* SL = DL.getStructLayout(CS->getType());
+    uint64_t size = SL->getSizeInBytes();
+    if (CS->getNumOperands() == 0 || Offset >= size) return false;
+    unsigned i = SL->getElementContainingOffset(Offset);
+    uint64_t fieldOffset = SL->getElementOffset(i);
+    return getConstantBytes(CS->getOperand(i), Offset - fieldOffset, DL, bytes);
+  }
+  return false;
+}
+
+
+
+// make_rpc(ret, func_name.ptr, func_name.len, input): the callee name is the
+// global string behind operand 1, from the constant offset operand 1 points
+// at, cut to the length in operand 2. "" if the offset is not constant.
+std::string MergeSymbolIndex::getRPCCalleeName(CallBase* RPCInst) {
+  const Value* funcNameValue = RPCInst->getOperand(1)->stripPointerCasts();
+  auto it = RPCCalleeNames.find(funcNameValue);
+  if ((it == RPCCalleeNames.end()) || (it->second.first != funcNameValue)) {
+    std::string bytes;
+    const DataLayout& DL = RPCInst->getModule()->getDataLayout();
+    APInt offset(DL.getIndexTypeSizeInBits(funcNameValue->getType()), 0);
+    const Value* base = funcNameValue->stripAndAccumulateConstantOffsets(DL, offset, true);
+    const GlobalVariable* GV = dyn_cast<GlobalVariable>(base);
+    if (GV && GV->hasInitializer() && !offset.isNegative())
+      getConstantBytes(GV->getInitializer(), offset.getZExtValue(), DL, bytes);
+    RPCCalleeNames[funcNameValue] = {WeakVH(const_cast<Value*>(funcNameValue)), bytes};
+    it = RPCCalleeNames.find(funcNameValue);
+  }
+  std::string fname = it->second.second;
+  if (auto* len = dyn_cast<ConstantInt>(RPCInst->getOperand(2))) {
+    if (len->getZExtValue() < fname.size()) fname.resize(len->getZExtValue());
+  }
+  else {
+    size_t nul = fname.find('\0');
+    if (nul != std::string::npos) fname.resize(nul);
+  }
+  return fname;
+}
+
+
+
+PreservedAnalyses llvm::getRenamePreservedAnalyses() {
+  PreservedAnalyses PA = PreservedAnalyses::all();
+  PA.abandon<MergeSymbolIndexAnalysis>();
+  return PA;
+}
+
+
+
+PreservedAnalyses llvm::getMergePreservedAnalyses() {
+  PreservedAnalyses PA = PreservedAnalyses::none();
+  PA.preserve<RustDemangleAnalysis>();
+  PA.preserve<SwiftDemangleAnalysis>();
+  return PA;
+}
@@ -0,0 +1,77 @@
+//===-- MergeSymbolIndex.h - Transformations --------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_UTILS_MERGESYMBOLINDEX_H
+#define LLVM_TRANSFORMS_UTILS_MERGESYMBOLINDEX_H
+
+#include "llvm/IR/PassManager.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/ValueHandle.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Transforms/Utils/MergeCallSites.h"
+#include "llvm/Transforms/Utils/RustDemangle.h"
+#include <vector>
+
+namespace llvm {
+
+// demangled name -> Function*, built from the module's function list without
+// looking at any instruction. The call sites of a name are the users of its
+// functions, so a lookup costs the number of calls rather than the module
+// size and also sees calls created after the index was built. Entries are weak
+// handles, so erased functions simply drop out of the index. Functions the
+// merge passes create after the scan (cloned callees) are added with
+// addFunction(). The callee names passed to make_rpc are read from their
+// constant strings and memoized as well.
+class MergeSymbolIndex {
+public:
+  MergeSymbolIndex(Module &M, RustDemangleCache &Demangler);
+
+  const std::string& getDemangledName(StringRef MangledName);
+  Function* getFunction(StringRef DemangledName);
+  std::vector<Function*> getFunctions(StringRef DemangledName);
+  std::vector<CallBase*> getCallSites(StringRef CalleeDemangledName);
+  std::vector<CallBase*> getCallSites(Function* Caller, StringRef CalleeDemangledName);
+  CallInst* getCall(Function* Caller, StringRef CalleeDemangledName);
+  InvokeInst* getInvoke(Function* Caller, StringRef CalleeDemangledName);
+  void addFunction(Function* F);
+  std::string getRPCCalleeName(CallBase* RPCInst);
+
+private:
+  bool isNamed(Function* F, StringRef DemangledName);
+
+  RustDemangleCache &Demangler;
+  StringMap<SmallVector<WeakVH, 1>> Functions;
+  // the handle tells whether the key still points to the same value
+  DenseMap<const Value*, std::pair<WeakVH, std::string>> RPCCalleeNames;
+};
+
+class MergeSymbolIndexAnalysis : public AnalysisInfoMixin<MergeSymbolIndexAnalysis> {
+  friend AnalysisInfoMixin<MergeSymbolIndexAnalysis>;
+  static AnalysisKey Key;
+
+public:
+  using Result = MergeSymbolIndex;
+  Result run(Module &M, ModuleAnalysisManager &AM);
+};
+
+// what a merge pass run leaves valid, so the passes can share one opt
+// pipeline. A rename only changes names: the index, keyed by demangled name,
+// is the one analysis to drop. Rewriting call sites and erasing functions
+// invalidates everything but the demangle caches, which are keyed by the
+// mangled name.
+PreservedAnalyses getRenamePreservedAnalyses();
+PreservedAnalyses getMergePreservedAnalyses();
+
+} // namespace llvm
+
+#endif // LLVM_TRANSFORMS_UTILS_MERGESYMBOLINDEX_H
@@ -0,0 +1,85 @@
+//===-- RustDedup.cpp - Transformations -----------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Utils/RustDedup.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/FunctionComparator.h"
+#include "llvm/Transforms/Utils/MergeSymbolIndex.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "rust-dedup"
+
+PreservedAnalyses RustDedupPass::run(Module &M, ModuleAnalysisManager &AM) {
+  RustDemangleCache &Demangler = AM.getResult<RustDemangleAnalysis>(M);
+  MergeStats RunStats("rust-dedup", M);
+  Stats = &RunStats;
+  MergePhase Phase(RunStats, "fold");
+  unsigned total = 0;
+  while (unsigned folded = dedupOnce(M, Demangler))
+    total += folded;
+  LLVM_DEBUG(dbgs()<<"RustDedup: folded "<<total<<" duplicate monomorphizations\n");
+  return total ? getMergePreservedAnalyses() : PreservedAnalyses::all();
+}
+
+
+
+// one round over the module, returns the number of functions folded
+unsigned RustDedupPass::dedupOnce(Module &M, RustDemangleCache &Demangler) {
+  // demangled name -> function type -> copies, in module order
+  StringMap<DenseMap<FunctionType*, std::vector<Function*>>> groups;
+  for (Function &F : M) {
+    if (F.isDeclaration() || F.isInterposable() ||
+        F.hasAvailableExternallyLinkage()) continue;
+    StringRef name = F.getName();
+    const std::string& demangled = Demangler.getDemangledName(name);
+    // not a rust symbol, leave it to mergefunc
+    if (demangled == name) continue;
+    groups[demangled][F.getFunctionType()].push_back(&F);
+  }
+
+  unsigned folded = 0;
+  for (auto &byName : groups) {
+    for (auto &byType : byName.second) {
+      if (byType.second.size() > 1) folded += foldGroup(byType.second);
+    }
+  }
+  return folded;
+}
+
+
+
+// fold every copy into the first structurally identical one before it
+unsigned RustDedupPass::foldGroup(std::vector<Function*>& Group) {
+  GlobalNumberState globalNumbers;
+  std::vector<Function*> kept;
+  std::vector<std::pair<Function*, Function*>> folds;
+  for (Function* F : Group) {
+    Function* same = nullptr;
+    for (Function* K : kept) {
+      if (FunctionComparator(K, F, &globalNumbers).compare() == 0) {
+        same = K;
+        break;
+      }
+    }
+    if (same) folds.push_back({F, same});
+    else kept.push_back(F);
+  }
+
+  for (auto &fold : folds) {
+    Function* dup = fold.first;
+    Function* keep = fold.second;
+    dup->replaceAllUsesWith(keep);
+    Stats->eraseFunction(dup);
+  }
+  return folds.size();
+}
@@ -0,0 +1,37 @@
+//===-- RustDedup.h - Transformations ---------------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_UTILS_RUSTDEDUP_H
+#define LLVM_TRANSFORMS_UTILS_RUSTDEDUP_H
+
+#include "llvm/IR/PassManager.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Transforms/Utils/MergeStats.h"
+#include "llvm/Transforms/Utils/RustDemangle.h"
+#include <vector>
+
+namespace llvm {
+
+// folds the structurally identical copies of a rust generic (same demangled
+// name and type) that every linked function brings along. Unlike `mergefunc`
+// it replaces all uses of a copy and erases it, leaving no thunk or alias.
+class RustDedupPass : public PassInfoMixin<RustDedupPass> {
+public:
+  PreservedAnalyses run(Module &M, ModuleAnalysisManager &AM);
+
+private:
+  unsigned dedupOnce(Module &M, RustDemangleCache &Demangler);
+  unsigned foldGroup(std::vector<Function*>& Group);
+
+  MergeStats* Stats = nullptr;
+};
+
+} // namespace llvm
+
+#endif // LLVM_TRANSFORMS_UTILS_RUSTDEDUP_H
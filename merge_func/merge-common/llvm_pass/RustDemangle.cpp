@@ -0,0 +1,148 @@
+//===-- RustDemangle.cpp - Transformations --------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Utils/RustDemangle.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Transforms/Utils/MergeStats.h"
+#include <vector>
+
+using namespace llvm;
+
+AnalysisKey RustDemangleAnalysis::Key;
+
+RustDemangleCache RustDemangleAnalysis::run(Module &M,
+                                            ModuleAnalysisManager &AM) {
+  return RustDemangleCache();
+}
+
+
+
+const std::string& RustDemangleCache::getDemangledName(StringRef MangledName) {
+  MergeStats::TotalDemangleLookups++;
+  auto it = DemangledNames.find(MangledName);
+  if (it != DemangledNames.end()) return it->second;
+  MergeStats::TotalDemangled++;
+  return DemangledNames.insert({MangledName, demangleRustSymbol(MangledName)}).first->second;
+}
+
+
+
+// the last path element of a legacy symbol is `h` + 16 hex digits
+static bool isRustHash(StringRef s) {
+  if (!s.starts_with("h") || s.size() == 1) return false;
+  for (char c : s.drop_front())
+    if (!isHexDigit(c)) return false;
+  return true;
+}
+
+
+
+// `$LT$`, `$u7b$`, ... are the escapes of the legacy mangling scheme
+static bool unescapeRustChar(StringRef escape, std::string& out) {
+  if (escape == "SP") out.push_back('@');
+  else if (escape == "BP") out.push_back('*');
+  else if (escape == "RF") out.push_back('&');
+  else if (escape == "LT") out.push_back('<');
+  else if (escape == "GT") out.push_back('>');
+  else if (escape == "LP") out.push_back('(');
+  else if (escape == "RP") out.push_back(')');
+  else if (escape == "C") out.push_back(',');
+  else if (escape.starts_with("u")) {
+    unsigned code;
+    if (escape.drop_front().getAsInteger(16, code) || code < 0x20 || code > 0x7e)
+      return false;
+    out.push_back((char)code);
+  }
+  else return false;
+  return true;
+}
+
+
+
+static void printLegacyElement(StringRef rest, std::string& out) {
+  if (rest.starts_with("_$")) rest = rest.drop_front();
+  while (!rest.empty()) {
+    if (rest.starts_with("..")) {
+      out += "::";
+      rest = rest.drop_front(2);
+    }
+    else if (rest.starts_with(".")) {
+      out.push_back('.');
+      rest = rest.drop_front();
+    }
+    else if (rest.starts_with("$")) {
+      size_t end = rest.find('$', 1);
+      if (end == StringRef::npos) break;
+      std::string unescaped;
+      if (!unescapeRustChar(rest.slice(1, end), unescaped)) break;
+      out += unescaped;
+      rest = rest.drop_front(end + 1);
+    }
+    else {
+      size_t next = rest.find_first_of("$.");
+      out += rest.substr(0, next).str();
+      rest = rest.substr(next == StringRef::npos ? rest.size() : next);
+    }
+  }
+  out += rest.str();
+}
+
+
+
+static bool demangleRustLegacy(StringRef name, std::string& out) {
+  StringRef inner;
+  if (name.starts_with("_ZN")) inner = name.drop_front(3);
+  else if (name.starts_with("ZN")) inner = name.drop_front(2);
+  else if (name.starts_with("__ZN")) inner = name.drop_front(4);
+  else return false;
+
+  std::vector<StringRef> elements;
+  while (!inner.starts_with("E")) {
+    size_t digits = 0;
+    while (digits < inner.size() && isDigit(inner[digits])) digits++;
+    unsigned len;
+    if (digits == 0 || inner.substr(0, digits).getAsInteger(10, len))
+      return false;
+    inner = inner.drop_front(digits);
+    if (len > inner.size()) return false;
+    elements.push_back(inner.substr(0, len));
+    inner = inner.drop_front(len);
+  }
+  inner = inner.drop_front();
+  if (elements.empty()) return false;
+  // whatever follows `E` must be a `.suffix`, otherwise it is not a rust symbol
+  if (!inner.empty() && !inner.starts_with(".")) return false;
+
+  for (unsigned i = 0; i < elements.size(); i++) {
+    if ((i + 1 == elements.size()) && (i != 0) && isRustHash(elements[i])) break;
+    if (i != 0) out += "::";
+    printLegacyElement(elements[i], out);
+  }
+  out += inner.str();
+  return true;
+}
+
+
+
+std::string llvm::demangleRustSymbol(StringRef MangledName) {
+  StringRef name = MangledName;
+  // drop the `.llvm.<hash>` suffix added by ThinLTO, like rustc_demangle does
+  size_t llvmSuffix = name.find(".llvm.");
+  if (llvmSuffix != StringRef::npos) {
+    StringRef suffix = name.drop_front(llvmSuffix + 6);
+    bool isLLVMHash = true;
+    for (char c : suffix)
+      if (!(isDigit(c) || (c >= 'A' && c <= 'F') || c == '@')) isLLVMHash = false;
+    if (isLLVMHash) name = name.substr(0, llvmSuffix);
+  }
+
+  std::string demangled;
+  if (demangleRustLegacy(name, demangled)) return demangled;
+  if (name.starts_with("_R")) return llvm::demangle(name.str());
+  return MangledName.str();
+}
@@ -0,0 +1,52 @@
+//===-- RustDemangle.h - Transformations ------------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_UTILS_RUSTDEMANGLE_H
+#define LLVM_TRANSFORMS_UTILS_RUSTDEMANGLE_H
+
+#include "llvm/IR/PassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Demangle/Demangle.h"
+#include <string>
+
+namespace llvm {
+
+// demangle a rust symbol (legacy `_ZN...E` or v0 `_R...`) the same way
+// `rustc_demangle` prints it with `{:#}`, i.e. without the trailing hash.
+// Symbols that are not rust symbols are returned unchanged.
+std::string demangleRustSymbol(StringRef MangledName);
+
+// memoized mangled -> demangled map. A symbol always demangles to the
+// same string, so the cache never goes stale when functions are renamed
+// or erased and can be shared by every merge pass run on the module.
+class RustDemangleCache {
+public:
+  const std::string& getDemangledName(StringRef MangledName);
+  bool invalidate(Module&, const PreservedAnalyses&,
+                  ModuleAnalysisManager::Invalidator&) {
+    return false;
+  }
+
+private:
+  StringMap<std::string> DemangledNames;
+};
+
+class RustDemangleAnalysis : public AnalysisInfoMixin<RustDemangleAnalysis> {
+  friend AnalysisInfoMixin<RustDemangleAnalysis>;
+  static AnalysisKey Key;
+
+public:
+  using Result = RustDemangleCache;
+  Result run(Module &M, ModuleAnalysisManager &AM);
+};
+
+} // namespace llvm
+
+#endif // LLVM_TRANSFORMS_UTILS_RUSTDEMANGLE_H
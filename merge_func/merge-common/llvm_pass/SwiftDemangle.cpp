@@ -0,0 +1,99 @@
+//===-- SwiftDemangle.cpp - Transformations -------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Utils/SwiftDemangle.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/MergeStats.h"
+#include <optional>
+
+using namespace llvm;
+
+static cl::opt<std::string> SwiftDemangleBin(
+                                     "swift-demangle-bin", cl::Hidden,
+                                     cl::desc("path of the swift-demangle tool"),
+                                     cl::init("swift-demangle"));
+
+AnalysisKey SwiftDemangleAnalysis::Key;
+
+SwiftDemangleCache SwiftDemangleAnalysis::run(Module &M,
+                                              ModuleAnalysisManager &AM) {
+  return SwiftDemangleCache(M);
+}
+
+
+
+SwiftDemangleCache::SwiftDemangleCache(Module &M) {
+  std::vector<std::string> names;
+  for (Function &F : M)
+    names.push_back(F.getName().str());
+  demangleBatch(names);
+}
+
+
+
+const std::string& SwiftDemangleCache::getDemangledName(StringRef MangledName) {
+  MergeStats::TotalDemangleLookups++;
+  auto it = DemangledNames.find(MangledName);
+  if (it == DemangledNames.end()) {
+    demangleBatch({MangledName.str()});
+    it = DemangledNames.find(MangledName);
+  }
+  return it->second;
+}
+
+
+
+// swift-demangle reads one symbol per line from stdin and prints one
+// demangled line for each of them, so the i-th output line belongs to the
+// i-th input name. The names go through uniquely named temp files, which
+// keeps concurrent opt runs from stepping on each other.
+void SwiftDemangleCache::demangleBatch(ArrayRef<std::string> MangledNames) {
+  MergeStats::TotalDemangled += MangledNames.size();
+  for (auto &name : MangledNames)
+    DemangledNames.insert({name, name});
+
+  SmallString<128> inputPath, outputPath;
+  if (sys::fs::createTemporaryFile("swift-demangle-in", "txt", inputPath) ||
+      sys::fs::createTemporaryFile("swift-demangle-out", "txt", outputPath)) {
+    llvm::errs()<<"SwiftDemangle Error: cannot create temp files\n";
+    return;
+  }
+  FileRemover inputRemover(inputPath);
+  FileRemover outputRemover(outputPath);
+
+  std::error_code EC;
+  raw_fd_ostream input(inputPath, EC, sys::fs::OF_Text);
+  if (EC) return;
+  for (auto &name : MangledNames)
+    input<<name<<"\n";
+  input.close();
+
+  auto program = sys::findProgramByName(SwiftDemangleBin);
+  if (!program) {
+    llvm::errs()<<"SwiftDemangle Error: cannot find "<<SwiftDemangleBin<<"\n";
+    return;
+  }
+  std::optional<StringRef> redirects[] = {StringRef(inputPath), StringRef(outputPath), std::nullopt};
+  StringRef args[] = {*program};
+  if (sys::ExecuteAndWait(*program, args, std::nullopt, redirects) != 0) {
+    llvm::errs()<<"SwiftDemangle Error: "<<*program<<" failed\n";
+    return;
+  }
+
+  auto output = MemoryBuffer::getFile(outputPath);
+  if (!output) return;
+  SmallVector<StringRef, 0> lines;
+  (*output)->getBuffer().split(lines, '\n');
+  for (unsigned i = 0; i < MangledNames.size() && i < lines.size(); i++)
+    DemangledNames[MangledNames[i]] = lines[i].str();
+}
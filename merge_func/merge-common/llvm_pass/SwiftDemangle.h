@@ -0,0 +1,52 @@
+//===-- SwiftDemangle.h - Transformations -----------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_UTILS_SWIFTDEMANGLE_H
+#define LLVM_TRANSFORMS_UTILS_SWIFTDEMANGLE_H
+
+#include "llvm/IR/PassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include <string>
+#include <vector>
+
+namespace llvm {
+
+// memoized mangled -> demangled map for swift symbols. Instead of one
+// `swift-demangle` process per name, all the names of a module are piped
+// through a single `swift-demangle` run when the cache is created. Names
+// that show up later are demangled in one more batch.
+class SwiftDemangleCache {
+public:
+  SwiftDemangleCache(Module &M);
+  const std::string& getDemangledName(StringRef MangledName);
+  bool invalidate(Module&, const PreservedAnalyses&,
+                  ModuleAnalysisManager::Invalidator&) {
+    return false;
+  }
+
+private:
+  void demangleBatch(ArrayRef<std::string> MangledNames);
+
+  StringMap<std::string> DemangledNames;
+};
+
+class SwiftDemangleAnalysis : public AnalysisInfoMixin<SwiftDemangleAnalysis> {
+  friend AnalysisInfoMixin<SwiftDemangleAnalysis>;
+  static AnalysisKey Key;
+
+public:
+  using Result = SwiftDemangleCache;
+  Result run(Module &M, ModuleAnalysisManager &AM);
+};
+
+} // namespace llvm
+
+#endif // LLVM_TRANSFORMS_UTILS_SWIFTDEMANGLE_H
@@ -0,0 +1,160 @@
+// conn_pool.c - share one Redis connection per backend in a fused function
+//
+// Every callee merged into a function still opens its own Redis connection
+// (redis::Client::get_connection), so a fused request pays one TCP handshake
+// per callee and backend. `merge.sh link` links this file into the fused
+// binary of a sync merge. It wraps connect(2): the first connection to a
+// pooled backend is kept open, later connects to the same address from the
+// same thread get a dup of that socket instead of a new handshake. Closing
+// the dup leaves the kept connection open.
+//
+// The sockets are per thread because the sync clients own the stream from a
+// command to its reply, two threads must never interleave on it. That is
+// also why only sync merges link it: the async merges run every RPC closure
+// on its own thread, where a per-thread pool shares nothing. Memcached is not
+// pooled by default either: memcache opens its sockets from the r2d2 worker
+// threads of each pool, and its timeout/tcp_nodelay setsockopt calls on a
+// dup would change the socket every other holder uses. get_connection sets
+// no socket option.
+//
+// Only blocking TCP sockets to the ports in MERGE_CONN_POOL_PORTS (default
+// "6379") are pooled; a kept socket that was closed by the server or still
+// has unread bytes is dropped and a fresh connection is made.
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define MAX_POOLED_CONNS 16
+#define MAX_POOLED_PORTS 16
+
+struct pooled_conn {
+  struct sockaddr_storage addr;
+  socklen_t addr_len;
+  int fd;
+};
+
+static __thread struct pooled_conn pool[MAX_POOLED_CONNS];
+static __thread int pool_size;
+
+static int (*real_connect)(int, const struct sockaddr *, socklen_t);
+static unsigned short pooled_ports[MAX_POOLED_PORTS];
+static int num_pooled_ports;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t pool_key;
+
+
+
+// runs when a thread that kept connections exits
+static void close_pool(void *unused) {
+  (void)unused;
+  for (int i = 0; i < pool_size; i++)
+    close(pool[i].fd);
+  pool_size = 0;
+}
+
+
+
+static void init_pool(void) {
+  real_connect = (int (*)(int, const struct sockaddr *, socklen_t))dlsym(RTLD_NEXT, "connect");
+  pthread_key_create(&pool_key, close_pool);
+
+  const char *env = getenv("MERGE_CONN_POOL_PORTS");
+  char *ports = strdup(env ? env : "6379");
+  char *save = NULL;
+  for (char *port = strtok_r(ports, ",", &save); port && num_pooled_ports < MAX_POOLED_PORTS;
+       port = strtok_r(NULL, ",", &save)) {
+    int p = atoi(port);
+    if (p > 0 && p < 65536) pooled_ports[num_pooled_ports++] = (unsigned short)p;
+  }
+  free(ports);
+}
+
+
+
+static int is_pooled_addr(const struct sockaddr *addr, socklen_t addr_len) {
+  unsigned short port;
+  if (addr->sa_family == AF_INET && addr_len >= sizeof(struct sockaddr_in))
+    port = ntohs(((const struct sockaddr_in *)addr)->sin_port);
+  else if (addr->sa_family == AF_INET6 && addr_len >= sizeof(struct sockaddr_in6))
+    port = ntohs(((const struct sockaddr_in6 *)addr)->sin6_port);
+  else
+    return 0;
+  for (int i = 0; i < num_pooled_ports; i++) {
+    if (pooled_ports[i] == port) return 1;
+  }
+  return 0;
+}
+
+
+
+static int is_blocking_tcp_socket(int fd) {
+  int type;
+  socklen_t len = sizeof(type);
+  if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) || type != SOCK_STREAM) return 0;
+  int flags = fcntl(fd, F_GETFL);
+  return flags >= 0 && !(flags & O_NONBLOCK);
+}
+
+
+
+// reusable only if the server didn't close it and no stale reply is waiting
+static int is_idle(int fd) {
+  char c;
+  int saved_errno = errno;
+  ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  int idle = n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+  errno = saved_errno;
+  return idle;
+}
+
+
+
+static struct pooled_conn *find_conn(const struct sockaddr *addr, socklen_t addr_len) {
+  for (int i = 0; i < pool_size; i++) {
+    if (pool[i].addr_len == addr_len && !memcmp(&pool[i].addr, addr, addr_len))
+      return &pool[i];
+  }
+  return NULL;
+}
+
+
+
+int connect(int fd, const struct sockaddr *addr, socklen_t addr_len) {
+  pthread_once(&pool_once, init_pool);
+  if (!addr || addr_len > sizeof(struct sockaddr_storage) ||
+      !is_pooled_addr(addr, addr_len) || !is_blocking_tcp_socket(fd))
+    return real_connect(fd, addr, addr_len);
+
+  struct pooled_conn *conn = find_conn(addr, addr_len);
+  if (conn) {
+    int fd_flags = fcntl(fd, F_GETFD);
+    if (is_idle(conn->fd) && dup2(conn->fd, fd) >= 0) {
+      // dup2 clears FD_CLOEXEC, keep what the socket was created with
+      if (fd_flags >= 0) fcntl(fd, F_SETFD, fd_flags);
+      return 0;
+    }
+    close(conn->fd);
+    *conn = pool[--pool_size];
+  }
+
+  int ret = real_connect(fd, addr, addr_len);
+  if (ret == 0 && pool_size < MAX_POOLED_CONNS) {
+    int kept = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (kept >= 0) {
+      conn = &pool[pool_size++];
+      memcpy(&conn->addr, addr, addr_len);
+      conn->addr_len = addr_len;
+      conn->fd = kept;
+      pthread_setspecific(pool_key, pool);
+    }
+  }
+  return ret;
+}
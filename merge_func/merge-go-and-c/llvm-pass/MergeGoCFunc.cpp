@@ -46,8 +46,12 @@ static cl::opt<std::string> CalleeNameGc("callee-name-gc", cl::Hidden,
                                          cl::init(""));
 
 PreservedAnalyses MergeGoCFuncPass::run(Module &M, ModuleAnalysisManager &AM) {
+  MergeStats RunStats("merge-go-c-func", M);
+  Stats = &RunStats;
   bool Changed = false;
   if (RenameCallerGc) {
+    RunStats.setMode("rename-caller");
+    MergePhase Phase(RunStats, "rename");
     if (CallerNameGc.empty()) {
       llvm::errs()
           << "RenameCaller Error: didn't specify caller function name\n";
@@ -55,6 +59,8 @@ PreservedAnalyses MergeGoCFuncPass::run(Module &M, ModuleAnalysisManager &AM) {
     renameCaller(&M);
     Changed = true;
   } else if (RenameCalleeGc) {
+    RunStats.setMode("rename-callee");
+    MergePhase Phase(RunStats, "rename");
     if (CalleeNameGc.empty()) {
       llvm::errs()
           << "RenameCallee Error: didn't specify callee function name\n";
@@ -62,12 +68,18 @@ PreservedAnalyses MergeGoCFuncPass::run(Module &M, ModuleAnalysisManager &AM) {
     renameCallee(&M);
     Changed = true;
   } else if (MergeCalleeGc) {
+    RunStats.setMode("merge-callee");
+    MergePhase Phase(RunStats, "clone");
     cloneAndReplaceFunc(&M);
     Changed = true;
   } else if (ReplaceMakeRpc) {
+    RunStats.setMode("replace-make-rpc");
+    MergePhase Phase(RunStats, "replace-rpcs");
     replaceMakeRpcCall(&M);
     Changed = true;
   } else if (ReplaceDummybyCallee) {
+    RunStats.setMode("replace-dummy");
+    MergePhase Phase(RunStats, "replace-dummy");
     replaceDummy(&M);
     Changed = true;
   }
@@ -136,6 +148,7 @@ void MergeGoCFuncPass::cloneAndReplaceFunc(Module *M) {
   SmallVector<ReturnInst *, 8> Returns;
   CloneFunctionInto(newCalleeFunc, MainFunc, VMap,
                     CloneFunctionChangeType::LocalChangesOnly, Returns);
+  Stats->addClonedFunc(newCalleeFunc);
 
   // change how the new callee function returns
   std::vector<ReturnInst *> RetInsts;
@@ -246,25 +259,13 @@ void MergeGoCFuncPass::cloneAndReplaceFunc(Module *M) {
   errs() << "Function '" << MainFunc->getName() << "' cloned to '"
          << newCalleeFunc->getName() << "' with modifications.\n";
 
-  MainFunc->eraseFromParent();
+  Stats->eraseFunction(MainFunc);
   return;
 }
 
 CallInst *MergeGoCFuncPass::getCallInstByCalledFunc(Function *callerFunc,
                                                     Function *calledFunc) {
-  for (Function::iterator BBB = callerFunc->begin(), BBE = callerFunc->end();
-       BBB != BBE; ++BBB) {
-    for (BasicBlock::iterator IB = BBB->begin(), IE = BBB->end(); IB != IE;
-         IB++) {
-      if (isa<CallInst>(IB)) {
-        CallInst *ci = dyn_cast<CallInst>(IB);
-        Function *func = ci->getCalledFunction();
-        if (func == calledFunc)
-          return ci;
-      }
-    }
-  }
-  return NULL;
+  return getCallTo(callerFunc, calledFunc);
 }
 
 void MergeGoCFuncPass::replaceMakeRpcCall(Module *M) {
@@ -309,6 +310,7 @@ void MergeGoCFuncPass::replaceMakeRpcCall(Module *M) {
     }
   }
   rpcInst->eraseFromParent();
+  Stats->addMergedEdge(CallerNameGc, CalleeNameGc, 1);
   return;
 }
 
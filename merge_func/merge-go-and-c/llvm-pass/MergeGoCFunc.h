@@ -30,6 +30,8 @@
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/MergeStats.h"
+#include "llvm/Transforms/Utils/MergeCallSites.h"
 
 namespace llvm {
 
@@ -44,6 +46,9 @@ public:
   void replaceDummy(Module *);
   CallInst *getCallInstByCalledFunc(Function *, Function *);
   void renameRealCallee(Function *MainFunc, std::string NewCalleeName);
+
+private:
+  MergeStats *Stats = nullptr;
 };
 
 } // namespace llvm
@@ -23,7 +23,10 @@ static cl::opt<std::string> RenameCallee_rc("rename-callee-rc",
 
 PreservedAnalyses MergeRustCFuncPass::run(Module &M,
                                           ModuleAnalysisManager &AM) {
+  MergeStats RunStats("merge-rust-c-func", M);
   if (MergeRustWrapper){
+    RunStats.setMode("merge-rust-wrapper");
+    MergePhase Phase(RunStats, "replace-rpcs");
     Function *CallerFunc;
     Function *mainFunc = M.getFunction("main");
     for (Function::iterator BBB = mainFunc->begin(), BBE = mainFunc->end(); BBB != BBE; ++BBB){
@@ -43,8 +46,11 @@ PreservedAnalyses MergeRustCFuncPass::run(Module &M,
     if (!realCalleeFunc) return PreservedAnalyses::all();
 
     createNewCallToReplaceRPC(CallerFunc, realCalleeFunc);
+    RunStats.addMergedEdge(CallerFunc->getName(), realCalleeFunc->getName(), 1);
   }
   else if (MergeWrapperC){
+    RunStats.setMode("merge-wrapper-c");
+    MergePhase Phase(RunStats, "clone");
     Function* WrapperMainFunc = M.getFunction("callee");
     Function* realWrapperFunc = findCallByCalleePrefix(WrapperMainFunc, "wrapper::callee_rust_to_c")->getCalledFunction();
 
@@ -53,10 +59,13 @@ PreservedAnalyses MergeRustCFuncPass::run(Module &M,
 
     Function* CalleeFuncInC = M.getFunction("main_callee_c");
     Function* NewCalleeFunc = createCNewCallee(CalleeFuncInC, dummyCall);
+    RunStats.addClonedFunc(NewCalleeFunc);
 
     createNewCallReplaceDummy(dummyCall, NewCalleeFunc);
   }
   else if (!RenameCallee_rc.empty()){
+    RunStats.setMode("rename-callee");
+    MergePhase Phase(RunStats, "rename");
     if ((RenameCallee_rc=="c") || (RenameCallee_rc=="C")) {
       Function *mainFunc = M.getFunction("main");
       mainFunc->setName("main_callee_c");
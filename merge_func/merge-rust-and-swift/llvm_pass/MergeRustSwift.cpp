@@ -8,7 +8,6 @@
 
 #include "llvm/Transforms/Utils/MergeRustSwift.h"
 #include <unistd.h>
-#include <sys/wait.h>
 
 using namespace llvm;
 
@@ -31,16 +30,28 @@ static cl::opt<bool> MergeCallee_rs(
 
 PreservedAnalyses MergeRustSwiftPass::run(Module &M,
                                        ModuleAnalysisManager &AM) {
+  SwiftDemangler = &AM.getResult<SwiftDemangleAnalysis>(M);
+  Index = &AM.getResult<MergeSymbolIndexAnalysis>(M);
+  MergeStats RunStats("merge-rust-swift", M);
+  Stats = &RunStats;
   if (RenameCallee_rs) {
+    RunStats.setMode("rename-callee");
+    MergePhase Phase(RunStats, "rename");
     RenameCallee(&M);
   }
   else if (RenameWrapperC2S_rs) {
+    RunStats.setMode("rename-wrapper-c2swift");
+    MergePhase Phase(RunStats, "rename");
     RenameWrapperC2Swift(&M);
   }
   else if (RenameWrapperR2C_rs) {
+    RunStats.setMode("rename-wrapper-rust2c");
+    MergePhase Phase(RunStats, "rename");
     RenameWrapperRust2C(&M);
   }
   else if (MergeCallee_rs) {
+    RunStats.setMode("merge-callee");
+    MergePhase Phase(RunStats, "merge");
     MergeCallee(&M);
   }
   return PreservedAnalyses::all();
@@ -117,6 +128,8 @@ void MergeRustSwiftPass::MergeCallee(Module* M) {
 
   Function* newCalleeFunc = createNewCalleeFunc(calleeFunc, dummyCall); 
   createCall2NewCallee(dummyCall, newCalleeFunc);
+  Stats->addClonedFunc(newCalleeFunc);
+  Stats->addMergedEdge(callerFunc->getName(), calleeFunc->getName(), 1);
 
 }
 
@@ -149,51 +162,7 @@ Function* MergeRustSwiftPass::getCFunctionByDemangledName(Module* M, std::string
 }
 
 std::string MergeRustSwiftPass::getDemangledSwiftFunctionName(std::string mangledName) {
-  int pipe_to_child[2];   // Pipe for sending data to child (stdin)
-  int pipe_from_child[2]; // Pipe for receiving data from child (stdout)
-  char buffer[1024];
-  if (pipe(pipe_to_child) == -1 || pipe(pipe_from_child) == -1) {
-    perror("pipe");
-  }
-
-  pid_t pid = fork();
-  if (pid == -1) {
-    perror("fork");
-  } 
-  else if (pid == 0) {
-    // Child process
-    close(pipe_to_child[1]); 
-    close(pipe_from_child[0]);
-    // Redirect stdin to read from pipe_to_child
-    dup2(pipe_to_child[0], STDIN_FILENO);
-    close(pipe_to_child[0]); // Close the original descriptor
-    // Redirect stdout to write to pipe_from_child
-    dup2(pipe_from_child[1], STDOUT_FILENO);
-    close(pipe_from_child[1]); 
-
-    execlp("swift-demangle", "swift-demangle", nullptr);
-    perror("execlp"); 
-  } 
-  else {
-    // Parent process
-    close(pipe_to_child[0]); 
-    close(pipe_from_child[1]);
-
-    const char* input = mangledName.c_str();
-    write(pipe_to_child[1], input, strlen(input));
-    close(pipe_to_child[1]); // Close the write end to signal EOF
-    // Read output from the child process's stdout
-    ssize_t bytes_read;
-    while ((bytes_read = read(pipe_from_child[0], buffer, sizeof(buffer) - 1)) > 0) {
-      buffer[bytes_read-1] = '\0'; 
-    }
-    close(pipe_from_child[0]);
-
-    int status;
-    waitpid(pid, &status, 0);
-  }
-  std::string ret(buffer);
-  return ret;
+  return SwiftDemangler->getDemangledName(mangledName);
 }
 
 
@@ -211,32 +180,12 @@ Function* MergeRustSwiftPass::getSwiftFunctionByDemangledName(Module* M, std::st
 
 
 CallInst* MergeRustSwiftPass::getCallInstByCalledFunc(Function* callerFunc, Function* calledFunc) {
-  for (Function::iterator BBB = callerFunc->begin(), BBE = callerFunc->end(); BBB != BBE; ++BBB){
-    for (BasicBlock::iterator IB = BBB->begin(), IE = BBB->end(); IB != IE; IB++){
-      if (isa<CallInst>(IB)) {
-        CallInst* ci = dyn_cast<CallInst>(IB);
-        Function* func = ci->getCalledFunction();
-        if (func == calledFunc) 
-          return ci;
-      }
-    }
-  }
-  return NULL; 
+  return getCallTo(callerFunc, calledFunc);
 }
 
 
 InvokeInst* MergeRustSwiftPass::getInvokeInstByCalledFunc(Function* callerFunc, Function* calledFunc) {
-  for (Function::iterator BBB = callerFunc->begin(), BBE = callerFunc->end(); BBB != BBE; ++BBB){
-    for (BasicBlock::iterator IB = BBB->begin(), IE = BBB->end(); IB != IE; IB++){
-      if (isa<InvokeInst>(IB)) {
-        InvokeInst* ii = dyn_cast<InvokeInst>(IB);
-        Function* func = ii->getCalledFunction();
-        if (func == calledFunc) 
-          return ii;
-      }
-    }
-  }
-  return NULL; 
+  return getInvokeTo(callerFunc, calledFunc);
 }
 
 
@@ -453,40 +402,11 @@ void MergeRustSwiftPass::createCall2NewCallee(CallInst* dummyCall, Function* new
 
 
 std::string MergeRustSwiftPass::getDemangledRustFuncName(std::string MangledFuncName) {
-  std::string command = demangle_bin + " \'" + MangledFuncName + "\'";
-
-  char* command_cstr = new char [command.length()+1];
-  strcpy (command_cstr, command.c_str());
-
-  FILE* fp1 = popen(command_cstr, "r");
-
-  while (fp1 == NULL){
-    sleep(1);
-    fp1 = popen(command_cstr, "r");
-    llvm::errs()<<"[tracer] fail to run demangle_rust_funcname\n";
-    llvm::errs()<<command<<"\n";
-  }
-
-  char path1[3000];
-  std::vector<std::string> lines;
-  while (fgets(path1, sizeof(path1), fp1) != NULL) {
-    std::string line(path1);
-    lines.push_back(line);
-  }
-  pclose(fp1);
-  if (lines.size()==1) { 
-    return lines[0];
-  }
-  return "";
+  return Index->getDemangledName(MangledFuncName);
 }
 
 
 
 Function* MergeRustSwiftPass::getRustFunctionByDemangledName(Module* M, std::string fname) {
-  for (Module::iterator f = M->begin(); f != M->end(); f++){
-    Function* func = dyn_cast<Function>(f);
-    std::string demangled = getDemangledRustFuncName(func->getName().str());
-    if (demangled == fname) return func;
-  }
-  return NULL;
+  return Index->getFunction(fname);
 }
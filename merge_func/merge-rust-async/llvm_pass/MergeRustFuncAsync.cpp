@@ -10,6 +10,8 @@
 
 using namespace llvm;
 
+#define DEBUG_TYPE "merge-rust-func-async"
+
 static cl::opt<bool> RenameCallee_rra(
                                      "rename-callee-rra", cl::init(false),
                                      cl::desc("rename the rust callee functions"));
@@ -39,21 +41,31 @@ static cl::opt<std::string> CallerName_rra(
 
 PreservedAnalyses MergeRustFuncAsyncPass::run(Module &M,
                                          ModuleAnalysisManager &AM) {
+  Index = &AM.getResult<MergeSymbolIndexAnalysis>(M);
+  MergeStats RunStats("merge-rust-func-async", M);
+  Stats = &RunStats;
   if (RenameCallee_rra) {
+    RunStats.setMode("rename-callee");
     if (CalleeName_rra == "") {
       llvm::errs()<<"RenameCallee Error: didn't specify callee function name\n";
       return PreservedAnalyses::all();
     }
+    MergePhase Phase(RunStats, "rename");
     RenameCallee(&M);
+    return getRenamePreservedAnalyses();
   }
   else if (RenameCaller_rra) {
+    RunStats.setMode("rename-caller");
     if (CallerName_rra == "") {
       llvm::errs()<<"RenameCaller Error: didn't specify caller function name\n";
       return PreservedAnalyses::all();
     }
+    MergePhase Phase(RunStats, "rename");
     RenameCaller(&M);
+    return getRenamePreservedAnalyses();
   }
   else if (MergeCallee_rra) {
+    RunStats.setMode("merge-callee");
     if (CalleeName_rra == "") {
       llvm::errs()<<"MergeCallee Error: didn't specify callee function name\n";
       return PreservedAnalyses::all();
@@ -63,8 +75,10 @@ PreservedAnalyses MergeRustFuncAsyncPass::run(Module &M,
       return PreservedAnalyses::all();
     }
     MergeCallee(&M);
+    return getMergePreservedAnalyses();
   }
   else if (MergeExistingCallee_rra) {
+    RunStats.setMode("merge-existing");
     if (CalleeName_rra == "") {
       llvm::errs()<<"MergeCallee Error: didn't specify callee function name\n";
       return PreservedAnalyses::all();
@@ -74,6 +88,7 @@ PreservedAnalyses MergeRustFuncAsyncPass::run(Module &M,
       return PreservedAnalyses::all();
     }
     MergeExistingCallee(&M);
+    return getMergePreservedAnalyses();
   }
   return PreservedAnalyses::all();
 }
@@ -99,38 +114,61 @@ void MergeRustFuncAsyncPass::RenameCaller(Module* M) {
 
 
 void MergeRustFuncAsyncPass::MergeCallee(Module* M) {
-  // get function::main::{{closure}}
-  // because it contains RPC (OpenFaaSRPC::make_rpc())
-  Function* mainClosure = getMainClosure(M, CallerName_rra, CalleeName_rra);
-  CallInst* rpcInst = getRPCinst(mainClosure, CalleeName_rra);
+  // get every function::main::{{closure}} that calls the callee
+  // because they contain RPC (OpenFaaSRPC::make_rpc())
+  std::vector<CallInst*> rpcInsts;
+  {
+    MergePhase Phase(*Stats, "find-rpcs");
+    rpcInsts = getRPCinsts(M, CallerName_rra, CalleeName_rra);
+  }
+  if (rpcInsts.empty()) {
+    llvm::errs()<<"MergeCallee error: no RPC to "<<CalleeName_rra<<" in the caller closures\n";
+    return;
+  }
 
   // create a function that has theesame arguments as `make_rpc`
   // but the function body is the callee function
   Function* CalleeFunc = M->getFunction("main_2nd_for_"+CalleeName_rra);
+  std::set<Function*> closures = getFunctions(rpcInsts);
 
-  Function* newCalleeFunc = cloneAndReplaceFuncWithDiffSignature(rpcInst, CalleeFunc, 
+  Function* newCalleeFunc;
+  {
+    MergePhase Phase(*Stats, "clone");
+    newCalleeFunc = cloneAndReplaceFuncWithDiffSignature(rpcInsts[0], CalleeFunc, 
                                         "new_callee_"+CalleeName_rra);
-  changeNewCalleeInput(newCalleeFunc);
-  changeNewCalleeOutput(newCalleeFunc);
+    Stats->addClonedFunc(newCalleeFunc);
+    changeNewCalleeInput(newCalleeFunc);
+    changeNewCalleeOutput(newCalleeFunc);
+  }
+
+  // the other closures (e.g. one thread per fanned out request) call the
+  // same new callee
+  {
+    MergePhase Phase(*Stats, "replace-rpcs");
+    for (unsigned i=1; i<rpcInsts.size(); i++)
+      replaceRPCWithCall(rpcInsts[i], newCalleeFunc);
+    reportMergedRPCs(closures, rpcInsts.size());
+  }
+  MergePhase Phase(*Stats, "erase");
+  eraseCalleeRuntime(M);
 }
 
 
 
 void MergeRustFuncAsyncPass::MergeExistingCallee(Module* M) {
-  // get function::main::{{closure}}
-  // because it contains RPC (OpenFaaSRPC::make_rpc())
-  Function* mainClosure = getMainClosure(M, CallerName_rra, CalleeName_rra);
-  CallInst* rpcInst = getRPCinst(mainClosure, CalleeName_rra);
+  std::vector<CallInst*> rpcInsts;
+  {
+    MergePhase Phase(*Stats, "find-rpcs");
+    rpcInsts = getRPCinsts(M, CallerName_rra, CalleeName_rra);
+  }
   Function *CalleeFunc = M->getFunction("new_callee_" + CalleeName_rra);
 
   if (CalleeFunc) {
-    std::vector<Value*> arguments;
-    for (unsigned i=0; i<rpcInst->getNumOperands()-1; i++){
-      Value* arg = rpcInst->getOperand(i);
-      arguments.push_back(arg);
-    }
-    CallInst* newCall = CallInst::Create(CalleeFunc->getFunctionType(), CalleeFunc, arguments,"", rpcInst);
-    rpcInst->eraseFromParent();
+    MergePhase Phase(*Stats, "replace-rpcs");
+    std::set<Function*> closures = getFunctions(rpcInsts);
+    for (CallInst* rpcInst : rpcInsts)
+      replaceRPCWithCall(rpcInst, CalleeFunc);
+    reportMergedRPCs(closures, rpcInsts.size());
   }
   else {
     llvm::errs()<<"MergeExistingCallee error: cannot find the callee function: new_callee_"
@@ -140,37 +178,93 @@ void MergeRustFuncAsyncPass::MergeExistingCallee(Module* M) {
 
 
 
-Function* MergeRustFuncAsyncPass::getMainClosure(Module* M, std::string caller_name, std::string callee_name) {
-  std::vector<Function*> main_funcs;
-  for (Module::iterator f = M->begin(); f != M->end(); f++){
-    Function* func = dyn_cast<Function>(f);
-    std::string FunctionName = func->getName().str();
-    if (hasSuffix(FunctionName, "_"+caller_name)) {
-      std::string OrigFuncName = stripSuffix(FunctionName, "_"+caller_name);
-      std::string demangled = getDemangledRustFuncName(OrigFuncName);
-      if (demangled == "function::main::{{closure}}") {
-        main_funcs.push_back(func);
-      }
-    }
+// the merged callee runs on the caller's runtime, drop the entry point and
+// std::rt::lang_start copy RenameCallee kept for it
+void MergeRustFuncAsyncPass::eraseCalleeRuntime(Module* M) {
+  const char* runtimeFuncs[] = {"main_for_", "std_rt_lang_start_for_", "main_2nd_for_"};
+  for (const char* prefix : runtimeFuncs) {
+    Function* F = M->getFunction(prefix + CalleeName_rra);
+    if (F && F->use_empty()) Stats->eraseFunction(F);
   }
-  for (auto f: main_funcs) {
-    for (Function::iterator BBB = f->begin(), BBE = f->end(); BBB != BBE; ++BBB){
-      for (BasicBlock::iterator IB = BBB->begin(), IE = BBB->end(); IB != IE; IB++){
-        if (isa<CallInst>(IB)) {
-          CallInst* ci = dyn_cast<CallInst>(IB);
-          Function* calledFunc = ci->getCalledFunction();
-          std::string calledFuncName = calledFunc->getName().str();
-          std::string demangledName = getDemangledRustFuncName(calledFuncName);
-          if (demangledName == "OpenFaaSRPC::make_rpc") {
-            if (getRPCCalleeName(ci) == callee_name) {
-              return f;
-            }
-          } 
-        }
-      }
+}
+
+
+
+void MergeRustFuncAsyncPass::replaceRPCWithCall(CallInst* rpcInst, Function* CalleeFunc) {
+  std::vector<Value*> arguments;
+  for (unsigned i=0; i<rpcInst->getNumOperands()-1; i++){
+    Value* arg = rpcInst->getOperand(i);
+    arguments.push_back(arg);
+  }
+  CallInst* newCall = CallInst::Create(CalleeFunc->getFunctionType(), CalleeFunc, arguments,"", rpcInst);
+  newCall->setAttributes(rpcInst->getAttributes());
+  rpcInst->eraseFromParent();
+}
+
+
+
+std::set<Function*> MergeRustFuncAsyncPass::getFunctions(std::vector<CallInst*>& calls) {
+  std::set<Function*> funcs;
+  for (CallInst* call : calls)
+    funcs.insert(call->getFunction());
+  return funcs;
+}
+
+
+
+// the merged callee keeps running concurrently with its siblings as long
+// as the closure that called make_rpc is still run by std::thread::spawn
+void MergeRustFuncAsyncPass::reportMergedRPCs(std::set<Function*>& closures, unsigned numRPCs) {
+  Stats->addMergedEdge(CallerName_rra, CalleeName_rra, numRPCs);
+  LLVM_DEBUG({
+    unsigned spawned = 0;
+    for (Function* closure : closures) {
+      if (isSpawnedClosure(closure)) spawned++;
     }
+    dbgs()<<"Merge: "<<CallerName_rra<<" -> "<<CalleeName_rra<<": "<<numRPCs
+          <<" make_rpc call(s) in "<<closures.size()<<" closure(s), "
+          <<spawned<<" of them run on a spawned thread\n";
+  });
+}
+
+
+
+bool MergeRustFuncAsyncPass::isSpawnedClosure(Function* closure) {
+  for (User* U : closure->users()) {
+    CallBase* call = dyn_cast<CallBase>(U);
+    if (!call) continue;
+    std::string caller = getDemangledRustFuncName(call->getFunction()->getName().str());
+    if (caller.find("__rust_begin_short_backtrace") != std::string::npos) return true;
   }
-  return NULL;
+  return false;
+}
+
+
+
+std::vector<CallInst*> MergeRustFuncAsyncPass::getRPCinsts(Module* M, std::string caller_name, std::string callee_name) {
+  std::vector<CallInst*> rpcInsts;
+  for (Function* mainClosure : getMainClosures(M, caller_name, callee_name)) {
+    std::vector<CallInst*> calls = getRPCinsts(mainClosure, callee_name);
+    rpcInsts.insert(rpcInsts.end(), calls.begin(), calls.end());
+  }
+  return rpcInsts;
+}
+
+
+
+std::vector<Function*> MergeRustFuncAsyncPass::getMainClosures(Module* M, std::string caller_name, std::string callee_name) {
+  // only the functions that call make_rpc can be the main closure
+  std::vector<Function*> closures;
+  for (CallBase* call : Index->getCallSites("OpenFaaSRPC::make_rpc")) {
+    Function* f = call->getFunction();
+    if (std::find(closures.begin(), closures.end(), f) != closures.end()) continue;
+    std::string FunctionName = f->getName().str();
+    if (!hasSuffix(FunctionName, "_"+caller_name)) continue;
+    std::string OrigFuncName = stripSuffix(FunctionName, "_"+caller_name);
+    if (getDemangledRustFuncName(OrigFuncName) != "function::main::{{closure}}") continue;
+    if (Index->getRPCCalleeName(call) == callee_name) closures.push_back(f);
+  }
+  return closures;
 }
 
 
@@ -192,37 +286,35 @@ std::string MergeRustFuncAsyncPass::stripSuffix(std::string str, std::string suf
 
 
 void MergeRustFuncAsyncPass::RenameFunctionMainClosure(Module* M, std::string suffix) {
-  std::vector<Function*> main_funcs;
-  for (Module::iterator f = M->begin(); f != M->end(); f++){
-    Function* func = dyn_cast<Function>(f);
-    std::string demangled = getDemangledRustFuncName(func->getName().str());
-    if (demangled == "function::main::{{closure}}") {
-      std::string func_name = func->getName().str();
-      func_name = func_name + "_" + suffix;
-      func->setName(func_name);
-    }
+  std::vector<Function*> main_funcs = Index->getFunctions("function::main::{{closure}}");
+  for (auto func: main_funcs) {
+    std::string func_name = func->getName().str();
+    func_name = func_name + "_" + suffix;
+    func->setName(func_name);
   } 
 }
 
 
 
-CallInst* MergeRustFuncAsyncPass::getRPCinst(Function* f, std::string callee_name){
-  for (Function::iterator BBB = f->begin(), BBE = f->end(); BBB != BBE; ++BBB){
-    for (BasicBlock::iterator IB = BBB->begin(), IE = BBB->end(); IB != IE; IB++){
-      if (isa<CallInst>(IB)) {
-        CallInst* ci = dyn_cast<CallInst>(IB);
-        Function* calledFunc = ci->getCalledFunction();
-        std::string calledFuncName = calledFunc->getName().str();
-        std::string demangledName = getDemangledRustFuncName(calledFuncName);
-        if (demangledName == "OpenFaaSRPC::make_rpc") {
-          if (getRPCCalleeName(ci) == callee_name) {
-            return ci;
-          }
-        } 
-      }
+// all the make_rpc calls to the callee, an invoke is turned into a call
+// first so that every site can be replaced the same way
+std::vector<CallInst*> MergeRustFuncAsyncPass::getRPCinsts(Function* f, std::string callee_name){
+  std::vector<CallInst*> calls;
+  for (CallBase* call : Index->getCallSites(f, "OpenFaaSRPC::make_rpc")) {
+    if (Index->getRPCCalleeName(call) != callee_name) continue;
+    if (InvokeInst* ii = dyn_cast<InvokeInst>(call)) {
+      SmallVector<Value*, 4> arguments(ii->args());
+      CallInst* ci = CallInst::Create(ii->getFunctionType(), ii->getCalledOperand(), arguments, "", ii);
+      ci->setAttributes(ii->getAttributes());
+      ii->replaceAllUsesWith(ci);
+      ii->getUnwindDest()->removePredecessor(ii->getParent());
+      BranchInst::Create(ii->getNormalDest(), ii);
+      ii->eraseFromParent();
+      calls.push_back(ci);
     }
+    else calls.push_back(dyn_cast<CallInst>(call));
   }
-  return NULL;
+  return calls;
 }
 
 
@@ -236,115 +328,41 @@ bool MergeRustFuncAsyncPass::IsStringStartWith(std::string str, std::string subs
 
 
 std::string MergeRustFuncAsyncPass::getDemangledRustFuncName(std::string MangledFuncName) {
-  std::string command = demangle_bin + " \'" + MangledFuncName + "\'";
-
-  char* command_cstr = new char [command.length()+1];
-  strcpy (command_cstr, command.c_str());
-
-  FILE* fp1 = popen(command_cstr, "r");
-
-  while (fp1 == NULL){
-    sleep(1);
-    fp1 = popen(command_cstr, "r");
-    llvm::errs()<<"[tracer] fail to run demangle_rust_funcname\n";
-    llvm::errs()<<command<<"\n";
-  }
-
-  char path1[3000];
-  std::vector<std::string> lines;
-  while (fgets(path1, sizeof(path1), fp1) != NULL) {
-    std::string line(path1);
-    lines.push_back(line);
-  }
-  pclose(fp1);
-  if (lines.size()==1) { 
-    return lines[0];
-  }
-  return "";
+  return Index->getDemangledName(MangledFuncName);
 }
 
 
 
 std::string MergeRustFuncAsyncPass::getRPCCalleeName(CallInst* RPCInst){
-  Value* funcNameValue = RPCInst->getOperand(1);
-
-  std::error_code EC;
-  llvm::raw_fd_ostream output("tmp.txt", EC, sys::fs::OF_Text);
-
-  funcNameValue->print(output);
-  output.close();
-
-  std::ifstream ifs;
-  ifs.open("tmp.txt");
-  std::stringstream oss;
-  oss << ifs.rdbuf();
-  std::string content = oss.str();
-  ifs.close();
-  std::vector<int> idxs;
-  for (int i=0; i<content.size(); i++){
-    if (content[i]=='"') idxs.push_back(i);
-  }
-  std::string fname = content.substr(idxs[0]+1,idxs[1]-idxs[0]-1); 
-  return fname;
+  return Index->getRPCCalleeName(RPCInst);
 }
 
 
 
 CallInst* MergeRustFuncAsyncPass::getCallByDemangledName(Function* f, std::string fname) {
-  for (Function::iterator BBB = f->begin(), BBE = f->end(); BBB != BBE; ++BBB){
-    for (BasicBlock::iterator IB = BBB->begin(), IE = BBB->end(); IB != IE; IB++){
-      if (isa<CallInst>(IB)){
-        CallInst *ci = dyn_cast<CallInst>(IB);
-        Function* CalledFunc = ci->getCalledFunction();
-        std::string demangled = getDemangledRustFuncName(CalledFunc->getName().str());
-        if (demangled == fname) return ci;
-      }
-    }
-  }
-  return NULL; 
+  return Index->getCall(f, fname);
 }
 
 
 
 std::vector<CallInst*> MergeRustFuncAsyncPass::getCallsByDemangledName(Function* f, std::string fname){
   std::vector<CallInst*> calls;
-  for (Function::iterator BBB = f->begin(), BBE = f->end(); BBB != BBE; ++BBB){
-    for (BasicBlock::iterator IB = BBB->begin(), IE = BBB->end(); IB != IE; IB++){
-      if (isa<CallInst>(IB)){
-        CallInst *ci = dyn_cast<CallInst>(IB);
-        Function* CalledFunc = ci->getCalledFunction();
-        std::string demangled = getDemangledRustFuncName(CalledFunc->getName().str());
-        if (demangled == fname) calls.push_back(ci);
-      }
-    }
-  } 
+  for (CallBase* call : Index->getCallSites(f, fname)) {
+    if (isa<CallInst>(call)) calls.push_back(dyn_cast<CallInst>(call));
+  }
   return calls;
 }
 
 
 
 InvokeInst* MergeRustFuncAsyncPass::getInvokeByDemangledName(Function* f, std::string fname) {
-  for (Function::iterator BBB = f->begin(), BBE = f->end(); BBB != BBE; ++BBB){
-    for (BasicBlock::iterator IB = BBB->begin(), IE = BBB->end(); IB != IE; IB++){
-      if (isa<InvokeInst>(IB)) {
-        InvokeInst* ii = dyn_cast<InvokeInst>(IB);
-        std::string demangled = getDemangledRustFuncName(ii->getCalledFunction()->getName().str());
-        if (demangled == fname) return ii; 
-      } 
-    }
-  }
-  return NULL; 
+  return Index->getInvoke(f, fname);
 }
 
 
 
 Function* MergeRustFuncAsyncPass::getFunctionByDemangledName(Module* M, std::string fname) {
-  for (Module::iterator f = M->begin(); f != M->end(); f++){
-    Function* func = dyn_cast<Function>(f);
-    std::string demangled = getDemangledRustFuncName(func->getName().str());
-    if (demangled == fname) return func;
-  }
-  return NULL;
+  return Index->getFunction(fname);
 }
 
 
@@ -396,6 +414,7 @@ Function* MergeRustFuncAsyncPass::cloneAndReplaceFunc(CallInst* callOfTargetFunc
   }
  
   CloneFunctionInto(newFunc, targetFunc, VMap, llvm::CloneFunctionChangeType::LocalChangesOnly, Returns);
+  Index->addFunction(newFunc);
 
   // set attributes for the new callee function's arguments
   std::vector<AttributeSet> argumentAttrs;
@@ -452,6 +471,7 @@ Function* MergeRustFuncAsyncPass::cloneAndReplaceFuncWithDiffSignature(CallInst*
   SmallVector<ReturnInst*, 8> Returns;
 
   CloneFunctionInto(newCalleeFunc, targetFunc, VMap, llvm::CloneFunctionChangeType::LocalChangesOnly, Returns);
+  Index->addFunction(newCalleeFunc);
 
   // set attributes for the new callee function's arguments
   std::vector<AttributeSet> argumentAttrs;
@@ -31,7 +31,10 @@
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/Demangle/Demangle.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/MergeSymbolIndex.h"
+#include "llvm/Transforms/Utils/MergeStats.h"
 #include <fstream>
+#include <set>
 #include <sstream>
 #include <unistd.h>
 
@@ -52,8 +55,14 @@ public:
   void changeNewCalleeOutput(Function*);
   void changeNewCalleeInput(Function*);
   bool IsStringStartWith(std::string, std::string);
-  Function* getMainClosure(Module*, std::string, std::string);
-  CallInst* getRPCinst(Function*, std::string);
+  std::vector<Function*> getMainClosures(Module*, std::string, std::string);
+  std::vector<CallInst*> getRPCinsts(Function*, std::string);
+  std::vector<CallInst*> getRPCinsts(Module*, std::string, std::string);
+  void replaceRPCWithCall(CallInst*, Function*);
+  std::set<Function*> getFunctions(std::vector<CallInst*>&);
+  void reportMergedRPCs(std::set<Function*>&, unsigned);
+  bool isSpawnedClosure(Function*);
+  void eraseCalleeRuntime(Module*);
   bool hasSuffix(std::string, std::string);
   std::string stripSuffix(std::string, std::string);
   void RenameCallee(Module*);
@@ -63,7 +72,8 @@ public:
   void RenameFunctionMainClosure(Module*, std::string);
 
 private:
-  std::string demangle_bin = "/llvm/demangle_rust_funcname";
+  MergeSymbolIndex* Index = nullptr;
+  MergeStats* Stats = nullptr;
 };
 
 } // namespace llvm
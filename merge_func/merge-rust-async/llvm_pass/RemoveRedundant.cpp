@@ -10,88 +10,245 @@
 
 using namespace llvm;
 
+#define DEBUG_TYPE "remove-redundant"
+
+STATISTIC(NumRuntimeInitsCollapsed, "Number of duplicate runtime initializers collapsed");
+STATISTIC(NumUnreachableGlobals, "Number of unreachable globals removed");
+
+
+static cl::opt<bool> RemoveUnreachable(
+                                     "remove-unreachable", cl::init(true),
+                                     cl::desc("remove the functions and globals main cannot reach"));
 
 PreservedAnalyses RemoveRedundantPass::run(Module &M,
                                          ModuleAnalysisManager &AM) {
-/*
-  Function *mainFunc = M.getFunction("main");
-  std::unordered_set<Function*> visitedFuncs;
-  std::vector<Function*> FuncsToBeVisited;
-
-  visitedFuncs.insert(mainFunc);
-  FuncsToBeVisited.push_back(mainFunc);
-
-  while (!FuncsToBeVisited.empty()) {
-    Function* func = FuncsToBeVisited.front();
-    std::vector<Function*> calleeVec = getCalleeVec(func);
-    for (auto calleeFunc: calleeVec) {
-      if (visitedFuncs.find(calleeFunc) == visitedFuncs.end()) {
-        FuncsToBeVisited.push_back(calleeFunc);
-        visitedFuncs.insert(calleeFunc);
-      }
-    }
-    FuncsToBeVisited.erase(FuncsToBeVisited.begin());
-  } 
-
-  int functionCount = 0;
-  for (auto f = M.begin(); f!=M.end(); f++) {
-    functionCount++;
-  }
-
-  llvm::errs()<<visitedFuncs.size()<<"\n";
-  llvm::errs()<<functionCount<<"\n";
-    
-  std::vector<Function*> funcToBeErased;
-  do {
-    funcToBeErased.clear();
-    for (auto f=M.begin(); f != M.end(); f++) {
-      Function* func = dyn_cast<Function>(f);
-      if ((func->use_empty()) && (visitedFuncs.find(func) == visitedFuncs.end())) {
-        funcToBeErased.push_back(func);
-      }
+  MergeSymbolIndex &Index = AM.getResult<MergeSymbolIndexAnalysis>(M);
+  MergeStats RunStats("remove-redundant", M);
+  Stats = &RunStats;
+  bool Changed = false;
+  {
+    MergePhase Phase(RunStats, "curl-init");
+    Changed |= removeCurlInit(Index);
+  }
+  {
+    MergePhase Phase(RunStats, "runtime-init");
+    Changed |= collapseRuntimeInit(M);
+  }
+  if (RemoveUnreachable) {
+    MergePhase Phase(RunStats, "unreachable");
+    Changed |= removeUnreachable(M);
+  }
+
+  return Changed ? getMergePreservedAnalyses() : PreservedAnalyses::all();
+}
+
+
+
+bool RemoveRedundantPass::removeCurlInit(MergeSymbolIndex &Index) {
+  std::unordered_map<CallInst*, Function*> curl_call_and_func;
+  for (CallBase* call : Index.getCallSites("curl::init::{{closure}}")) {
+    if (isa<CallInst>(call)) {
+      curl_call_and_func[dyn_cast<CallInst>(call)] = call->getCalledFunction();
     }
-    for (auto func: funcToBeErased) {
-      func->eraseFromParent();
+  }
+
+  std::unordered_set<Function*> curl_funcs;
+  for (auto it = curl_call_and_func.begin(); it != curl_call_and_func.end(); it++) {
+    it->first->eraseFromParent();
+    curl_funcs.insert(it->second);
+  }
+  for (auto func: curl_funcs) {
+    if (func->use_empty()) Stats->eraseFunction(func);
+  }
+  return !curl_call_and_func.empty();
+}
+
+
+
+// every crate a fused callee linked in brings its own startup hooks. Once
+// rust-dedup has folded the duplicated crates the hooks point at the same
+// constructor, which would run once per callee at every cold start. Keep one
+// llvm.global_ctors/llvm.global_dtors entry and one `.init_array` slot per
+// constructor.
+bool RemoveRedundantPass::collapseRuntimeInit(Module &M) {
+  unsigned count = collapseStructors(M, "llvm.global_ctors") +
+                   collapseStructors(M, "llvm.global_dtors");
+
+  std::map<std::pair<StringRef, Constant*>, GlobalVariable*> initSlots;
+  std::unordered_set<Constant*> dupSlots;
+  for (GlobalVariable &GV : M.globals()) {
+    if (!GV.hasInitializer() || !GV.hasSection()) continue;
+    StringRef section = GV.getSection();
+    if (!section.starts_with(".init_array") && !section.starts_with(".fini_array")) continue;
+    auto key = std::make_pair(section, GV.getInitializer()->stripPointerCasts());
+    if (!initSlots.insert({key, &GV}).second) dupSlots.insert(&GV);
+  }
+  if (!dupSlots.empty()) {
+    removeFromUsedLists(M, [&](Constant* C) { return dupSlots.count(C) > 0; });
+    for (Constant* C : dupSlots) {
+      GlobalVariable* GV = cast<GlobalVariable>(C);
+      GV->removeDeadConstantUsers();
+      if (GV->use_empty()) GV->eraseFromParent();
     }
-  } while (!funcToBeErased.empty());
+    count += dupSlots.size();
+  }
+  NumRuntimeInitsCollapsed += count;
+  return count > 0;
+}
+
 
-  functionCount = 0;
-  for (auto f = M.begin(); f!=M.end(); f++) {
-    functionCount++;
+
+unsigned RemoveRedundantPass::collapseStructors(Module &M, StringRef ArrayName) {
+  GlobalVariable* array = M.getGlobalVariable(ArrayName);
+  if (!array || !array->hasInitializer()) return 0;
+  ConstantArray* entries = dyn_cast<ConstantArray>(array->getInitializer());
+  if (!entries) return 0;
+
+  // {priority, function, data}, the first entry of a (function, data) pair wins
+  std::vector<std::tuple<int, Function*, Constant*>> kept;
+  std::set<std::pair<Function*, Constant*>> seen;
+  for (Value* op : entries->operands()) {
+    ConstantStruct* entry = dyn_cast<ConstantStruct>(op);
+    if (!entry || entry->getNumOperands() < 3) return 0;
+    Function* F = dyn_cast<Function>(entry->getOperand(1)->stripPointerCasts());
+    ConstantInt* priority = dyn_cast<ConstantInt>(entry->getOperand(0));
+    if (!F || !priority) return 0;
+    Constant* data = entry->getOperand(2);
+    if (seen.insert({F, data->stripPointerCasts()}).second)
+      kept.push_back(std::make_tuple((int)priority->getSExtValue(), F, data));
   }
-  llvm::errs()<<functionCount<<"\n";
-*/
-  std::unordered_map<CallInst*, Function*> curl_call_and_func;
-  CallInst* call_curl_init = NULL;
-  Function* curl_init_func = NULL;
-  for (auto f = M.begin(); f != M.end(); f++) {
-    for (auto bb = f->begin(); bb != f->end(); bb++) {
-      for (auto inst = bb->begin(); inst!=bb->end(); inst++) {
-        if (isa<CallInst>(inst)) {
-          CallInst* ci = dyn_cast<CallInst>(inst);
-          Function* func = ci->getCalledFunction();
-          if (func){
-            std::string demangledFuncName = getDemangledRustFuncName(func->getName().str());
-            if (demangledFuncName == "curl::init::{{closure}}") {
-              curl_call_and_func[ci] = func;
-            }
-          }
+  unsigned dups = entries->getNumOperands() - kept.size();
+  if (!dups) return 0;
+
+  bool isCtors = ArrayName == "llvm.global_ctors";
+  array->eraseFromParent();
+  for (auto &entry : kept) {
+    if (isCtors) appendToGlobalCtors(M, std::get<1>(entry), std::get<0>(entry), std::get<2>(entry));
+    else appendToGlobalDtors(M, std::get<1>(entry), std::get<0>(entry), std::get<2>(entry));
+  }
+  return dups;
+}
+
+
+
+// everything the linked module must keep no matter who references it: the
+// entry point, the llvm.used/llvm.global_ctors style arrays, the unmangled
+// `__*` builtins llc may emit calls to, and symbols named in module asm
+std::vector<GlobalValue*> RemoveRedundantPass::getRoots(Module &M) {
+  std::vector<GlobalValue*> roots;
+  StringRef moduleAsm = M.getModuleInlineAsm();
+  for (GlobalValue &GV : M.global_values()) {
+    if (GV.isDeclaration()) continue;
+    StringRef name = GV.getName();
+    if ((name == "main") || GV.hasAppendingLinkage() ||
+        (isa<Function>(GV) && name.starts_with("__")) ||
+        (!name.empty() && moduleAsm.contains(name)))
+      roots.push_back(&GV);
+  }
+  return roots;
+}
+
+
+
+// the globals referenced by a constant, looking through constant
+// expressions and aggregates
+void RemoveRedundantPass::getReferencedGlobals(Constant* C,
+                                               std::unordered_set<Constant*>& visitedConsts,
+                                               std::vector<GlobalValue*>& globals) {
+  if (!visitedConsts.insert(C).second) return;
+  if (GlobalValue* GV = dyn_cast<GlobalValue>(C)) {
+    globals.push_back(GV);
+    return;
+  }
+  for (Value* op : C->operands()) {
+    if (Constant* opC = dyn_cast<Constant>(op))
+      getReferencedGlobals(opC, visitedConsts, globals);
+  }
+}
+
+
+
+// walk every reference (calls, address-taken functions, initializers,
+// personalities, aliasees) from the roots. Whatever is not reached can't
+// run in the fused binary: callee runtimes, std/curl/serde instances only
+// the erased callee mains used, and so on.
+bool RemoveRedundantPass::removeUnreachable(Module &M) {
+  std::unordered_set<GlobalValue*> reachable;
+  std::unordered_set<Constant*> visitedConsts;
+  std::vector<GlobalValue*> worklist = getRoots(M);
+  std::unordered_map<Comdat*, std::vector<GlobalValue*>> comdatMembers;
+  for (GlobalValue &GV : M.global_values()) {
+    if (Comdat* C = GV.getComdat()) comdatMembers[C].push_back(&GV);
+  }
+
+  while (!worklist.empty()) {
+    GlobalValue* GV = worklist.back();
+    worklist.pop_back();
+    if (!reachable.insert(GV).second) continue;
+    std::vector<GlobalValue*> refs;
+    // a comdat is kept or dropped as a whole
+    if (Comdat* C = GV->getComdat()) {
+      for (GlobalValue* member : comdatMembers[C]) refs.push_back(member);
+    }
+    if (Function* F = dyn_cast<Function>(GV)) {
+      for (Value* op : F->operands()) {
+        if (Constant* C = dyn_cast_or_null<Constant>(op))
+          getReferencedGlobals(C, visitedConsts, refs);
+      }
+      for (Instruction &I : instructions(F)) {
+        for (Value* op : I.operands()) {
+          if (Constant* C = dyn_cast<Constant>(op))
+            getReferencedGlobals(C, visitedConsts, refs);
         }
       }
     }
-  }  
-
-  for (auto it = curl_call_and_func.begin(); it != curl_call_and_func.end(); it++) {
-    llvm::errs()<<"@@@ "<<*it->first<<"\n";
+    else if (GlobalVariable* Var = dyn_cast<GlobalVariable>(GV)) {
+      if (Var->hasInitializer())
+        getReferencedGlobals(Var->getInitializer(), visitedConsts, refs);
+    }
+    else if (GlobalAlias* Alias = dyn_cast<GlobalAlias>(GV)) {
+      getReferencedGlobals(Alias->getAliasee(), visitedConsts, refs);
+    }
+    else if (GlobalIFunc* IFunc = dyn_cast<GlobalIFunc>(GV)) {
+      getReferencedGlobals(IFunc->getResolver(), visitedConsts, refs);
+    }
+    for (GlobalValue* ref : refs) {
+      if (!reachable.count(ref)) worklist.push_back(ref);
+    }
+  }
 
-    it->first->eraseFromParent();
-    it->second->eraseFromParent();
+  // drop the bodies first, dead code may reference itself in cycles
+  std::vector<GlobalValue*> dead;
+  for (GlobalValue &GV : M.global_values()) {
+    if (GV.isDeclaration() || reachable.count(&GV)) continue;
+    dead.push_back(&GV);
+  }
+  for (GlobalValue* GV : dead) {
+    if (Function* F = dyn_cast<Function>(GV)) {
+      Stats->addErasedFunc(F);
+      F->deleteBody();
+    }
+    else if (GlobalVariable* Var = dyn_cast<GlobalVariable>(GV)) Var->setInitializer(nullptr);
+    else if (GlobalAlias* Alias = dyn_cast<GlobalAlias>(GV)) Alias->setAliasee(PoisonValue::get(Alias->getType()));
+    if (GlobalObject* GO = dyn_cast<GlobalObject>(GV)) GO->setComdat(nullptr);
   }
 
-  return PreservedAnalyses::all();
+  for (GlobalValue* GV : dead) {
+    GV->removeDeadConstantUsers();
+    if (!GV->use_empty()) {
+      // only referenced from other dead aliases, keep it as a declaration
+      if (isa<GlobalAlias>(GV)) continue;
+      GV->setLinkage(GlobalValue::ExternalLinkage);
+      continue;
+    }
+    if (!isa<Function>(GV)) NumUnreachableGlobals++;
+    GV->eraseFromParent();
+  }
+  return !dead.empty();
 }
 
 
+
 std::vector<Function*> RemoveRedundantPass::getCalleeVec(Function* f) {
   std::vector<Function*> calleeVec;
   for (Function::iterator BBB = f->begin(), BBE = f->end(); BBB != BBE; ++BBB){
@@ -110,35 +267,3 @@ std::vector<Function*> RemoveRedundantPass::getCalleeVec(Function* f) {
   }
   return calleeVec;
 }
-
-
-
-std::string RemoveRedundantPass::getDemangledRustFuncName(std::string MangledFuncName) {
-  std::string command = demangle_bin + " \'" + MangledFuncName + "\'";
-
-  char* command_cstr = new char [command.length()+1];
-  strcpy (command_cstr, command.c_str());
-
-  FILE* fp1 = popen(command_cstr, "r");
-
-  while (fp1 == NULL){
-    sleep(1);
-    fp1 = popen(command_cstr, "r");
-    llvm::errs()<<"[tracer] fail to run demangle_rust_funcname\n";
-    llvm::errs()<<command<<"\n";
-  }
-
-  char path1[3000];
-  std::vector<std::string> lines;
-  while (fgets(path1, sizeof(path1), fp1) != NULL) {
-    std::string line(path1);
-    lines.push_back(line);
-  }
-  pclose(fp1);
-  if (lines.size()==1) { 
-    return lines[0];
-  }
-  return "";
-}
-
-
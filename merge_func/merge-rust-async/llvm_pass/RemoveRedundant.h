@@ -20,6 +20,7 @@
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/FileSystem.h"
@@ -28,12 +29,19 @@
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/Mangler.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/Demangle/Demangle.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/MergeSymbolIndex.h"
+#include "llvm/Transforms/Utils/MergeStats.h"
 #include <fstream>
+#include <map>
+#include <set>
 #include <sstream>
+#include <tuple>
 #include <unistd.h>
+#include <unordered_map>
 #include <unordered_set>
 
 namespace llvm {
@@ -42,8 +50,15 @@ class RemoveRedundantPass : public PassInfoMixin<RemoveRedundantPass> {
 public:
   PreservedAnalyses run(Module &F, ModuleAnalysisManager &AM);
   std::vector<Function*> getCalleeVec(Function*);
-  std::string getDemangledRustFuncName(std::string);
-  std::string demangle_bin = "/llvm/demangle_rust_funcname";
+  std::vector<GlobalValue*> getRoots(Module&);
+  void getReferencedGlobals(Constant*, std::unordered_set<Constant*>&, std::vector<GlobalValue*>&);
+  bool removeCurlInit(MergeSymbolIndex&);
+  bool removeUnreachable(Module&);
+  bool collapseRuntimeInit(Module&);
+  unsigned collapseStructors(Module&, StringRef);
+
+private:
+  MergeStats* Stats = nullptr;
 };
 
 } // namespace llvm
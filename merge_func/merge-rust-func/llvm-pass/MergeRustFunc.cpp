@@ -10,6 +10,10 @@
 
 using namespace llvm;
 
+#define DEBUG_TYPE "merge-rust-func"
+
+STATISTIC(NumTypedCalls, "Number of merged calls passing the argument struct by pointer");
+
 static cl::opt<bool> RenameCallee_rr(
                                      "rename-callee-rr", cl::init(false),
                                      cl::desc("rename the rust callee functions"));
@@ -30,6 +34,48 @@ static cl::opt<bool> MergeExistingCallee_rr(
                                      "merge-existing-rr", cl::init(false),
                                      cl::desc("merge with existing rust callee functions"));
 
+static cl::opt<bool> MergeTree_rr(
+                                     "merge-tree-rr", cl::init(false),
+                                     cl::desc("merge every edge of a function tree in one run"));
+
+static cl::opt<std::string> FuncTree_rr(
+                                     "func-tree-rr", cl::Hidden,
+                                     cl::desc("funcTree file, one 'caller callee' pair per line"),
+                                     cl::init(""));
+
+static cl::list<std::string> MergeEdges_rr(
+                                     "merge-edges-rr", cl::Hidden, cl::CommaSeparated,
+                                     cl::desc("caller:callee pairs to merge, in order"));
+
+static cl::opt<bool> ZeroCopyArgs_rr(
+                                     "zero-copy-args-rr", cl::init(false),
+                                     cl::desc("pass serde argument structs to merged callees by pointer"));
+
+static cl::opt<std::string> CallFreq_rr(
+                                     "call-freq-rr", cl::Hidden,
+                                     cl::desc("call-freq.json used to pick the edges of the tree to merge"),
+                                     cl::init(""));
+
+static cl::opt<std::string> CPUUsage_rr(
+                                     "cpu-usage-rr", cl::Hidden,
+                                     cl::desc("cpu-usage.json used to pick the edges of the tree to merge"),
+                                     cl::init(""));
+
+static cl::opt<uint64_t> MergeSizeBudget_rr(
+                                     "merge-size-budget-rr", cl::Hidden,
+                                     cl::desc("max IR instructions the merged callees may add (0: no limit)"),
+                                     cl::init(0));
+
+static cl::opt<uint64_t> MinCallFreq_rr(
+                                     "min-call-freq-rr", cl::Hidden,
+                                     cl::desc("don't merge edges called less often than this"),
+                                     cl::init(0));
+
+static cl::opt<uint64_t> MaxCalleeCPU_rr(
+                                     "max-callee-cpu-rr", cl::Hidden,
+                                     cl::desc("don't merge callees using more cpu than this (0: no limit)"),
+                                     cl::init(0));
+
 static cl::opt<std::string> CalleeName_rr(
                                      "callee-name-rr", cl::Hidden,
                                      cl::desc("callee function name"),
@@ -42,28 +88,42 @@ static cl::opt<std::string> CallerName_rr(
 
 PreservedAnalyses MergeRustFuncPass::run(Module &M,
                                          ModuleAnalysisManager &AM) {
+  Demangler = &AM.getResult<RustDemangleAnalysis>(M);
+  Index = &AM.getResult<MergeSymbolIndexAnalysis>(M);
+  MergeStats RunStats("merge-rust-func", M);
+  Stats = &RunStats;
+  NumMergedRPCs = 0;
   if (RenameCallee_rr) {
+    RunStats.setMode("rename-callee");
     if (CalleeName_rr == "") {
       llvm::errs()<<"RenameCallee Error: didn't specify callee function name\n";
       return PreservedAnalyses::all();
     }
+    MergePhase Phase(RunStats, "rename");
     renameCallee(&M);
+    return getRenamePreservedAnalyses();
   }
   else if (RenameCaller_rr) {
+    RunStats.setMode("rename-caller");
     if (CallerName_rr == "") {
       llvm::errs()<<"RenameCaller Error: didn't specify callee function name\n";
       return PreservedAnalyses::all();
     }
+    MergePhase Phase(RunStats, "rename");
     renameCaller(&M);
+    return getRenamePreservedAnalyses();
   }
   else if (MergeCallee_rr) {
+    RunStats.setMode("merge-callee");
     if (CalleeName_rr == "") {
       llvm::errs()<<"MergeCallee Error: didn't specify callee function name\n";
       return PreservedAnalyses::all();
     }
-    mergeCallee(&M);
+    mergeCallee(&M, CallerName_rr, CalleeName_rr);
+    return getMergePreservedAnalyses();
   }
   else if (MergeExistingCallee_rr) {
+    RunStats.setMode("merge-existing");
     if (CallerName_rr == "") {
       llvm::errs()<<"RenameCaller Error: didn't specify callee function name\n";
       return PreservedAnalyses::all();
@@ -72,7 +132,24 @@ PreservedAnalyses MergeRustFuncPass::run(Module &M,
       llvm::errs()<<"RenameCallee Error: didn't specify callee function name\n";
       return PreservedAnalyses::all();
     }
-    MergeExistingCallee(&M);
+    MergeExistingCallee(&M, CallerName_rr, CalleeName_rr);
+    return getMergePreservedAnalyses();
+  }
+  else if (MergeTree_rr) {
+    RunStats.setMode("merge-tree");
+    std::vector<std::pair<std::string, std::string>> edges;
+    if (!getMergeEdges(edges)) return PreservedAnalyses::all();
+    if (edges.empty()) {
+      llvm::errs()<<"MergeTree Error: didn't specify function tree\n";
+      return PreservedAnalyses::all();
+    }
+    if ((CallFreq_rr != "") || (CPUUsage_rr != "") || MergeSizeBudget_rr ||
+        MinCallFreq_rr || MaxCalleeCPU_rr) {
+      MergePhase Phase(RunStats, "plan");
+      if (!planMergeTree(&M, edges)) return PreservedAnalyses::all();
+    }
+    mergeTree(&M, edges);
+    return getMergePreservedAnalyses();
   }
   return PreservedAnalyses::all();
 }
@@ -113,91 +190,238 @@ void MergeRustFuncPass::renameRealCallee(Function* mainFunc, std::string newCall
 
 
 
-void MergeRustFuncPass::mergeCallee(Module* M) {
-  Function* CallerFunc = M->getFunction("NewCallee_"+CallerName_rr);
+// the edges come from -func-tree-rr (same format as the funcTree files read
+// by merge_tree.py) followed by the -merge-edges-rr pairs
+bool MergeRustFuncPass::getMergeEdges(std::vector<std::pair<std::string, std::string>>& edges) {
+  if (FuncTree_rr != "") {
+    auto buffer = MemoryBuffer::getFile(FuncTree_rr);
+    if (!buffer) {
+      llvm::errs()<<"MergeTree Error: cannot read "<<FuncTree_rr<<"\n";
+      return false;
+    }
+    SmallVector<StringRef, 16> lines;
+    (*buffer)->getBuffer().split(lines, '\n', -1, false);
+    for (StringRef line : lines) {
+      SmallVector<StringRef, 2> words;
+      line.split(words, ' ', -1, false);
+      if (words.empty()) continue;
+      if (words.size() < 2) {
+        llvm::errs()<<"MergeTree Error: bad edge '"<<line<<"'\n";
+        return false;
+      }
+      edges.push_back({words[0].trim().str(), words[1].trim().str()});
+    }
+  }
+  for (auto &edge : MergeEdges_rr) {
+    std::pair<StringRef, StringRef> names = StringRef(edge).split(':');
+    if (names.first.empty() || names.second.empty()) {
+      llvm::errs()<<"MergeTree Error: bad edge '"<<edge<<"'\n";
+      return false;
+    }
+    edges.push_back({names.first.str(), names.second.str()});
+  }
+  return true;
+}
+
+
+
+// keep only the edges the profile says are worth fusing. Callees that end up
+// behind an RPC everywhere are dropped from the module again.
+bool MergeRustFuncPass::planMergeTree(Module* M, std::vector<std::pair<std::string, std::string>>& edges) {
+  MergePlanner planner;
+  if ((CallFreq_rr != "") && !planner.loadCallFreq(CallFreq_rr)) return false;
+  if ((CPUUsage_rr != "") && !planner.loadCPUUsage(CPUUsage_rr)) return false;
+
+  std::string entry = edges[0].first;
+  planner.setFunction(entry, M->getFunction("NewCallee_"+entry));
+  for (auto &edge : edges)
+    planner.setFunction(edge.second, M->getFunction("callee_"+edge.second));
+  std::vector<std::pair<std::string, std::string>> plan =
+      planner.plan(entry, edges, MergeSizeBudget_rr, MinCallFreq_rr, MaxCalleeCPU_rr);
+
+  StringSet<> dropped;
+  for (auto &edge : edges) {
+    if (!planner.getFusedFunctions().count(edge.second) && dropped.insert(edge.second).second) {
+      Function* f1 = M->getFunction("main_callee_rust_"+edge.second);
+      Function* f2 = M->getFunction("_std_rt_lang_start_callee_"+edge.second);
+      Function* f3 = M->getFunction("callee_"+edge.second);
+      Stats->eraseFunction(f1);
+      Stats->eraseFunction(f2);
+      Stats->eraseFunction(f3);
+    }
+  }
+  edges = plan;
+  return true;
+}
+
+
+
+// The module holds the renamed caller and every renamed callee, linked once.
+// Edges are merged in order: the first edge into a callee clones it, later
+// ones call the clone, exactly like a merge/merge_existing sequence.
+void MergeRustFuncPass::mergeTree(Module* M, std::vector<std::pair<std::string, std::string>>& edges) {
+  StringSet<> mergedFuncs;
+  for (auto &edge : edges) {
+    if (mergedFuncs.insert(edge.second).second)
+      mergeCallee(M, edge.first, edge.second);
+    else
+      MergeExistingCallee(M, edge.first, edge.second);
+  }
+  LLVM_DEBUG(dbgs()<<"MergeTree: "<<NumMergedRPCs<<" make_rpc call(s) eliminated\n");
+
+  // with -zero-copy-args-rr a callee may only be called through one of its
+  // two versions
+  for (auto &edge : edges) {
+    Function* F = M->getFunction("NewCallee_"+edge.second);
+    Function* TypedF = M->getFunction("NewCallee_"+edge.second+"_typed");
+    if (!F || !TypedF) continue;
+    if (F->use_empty()) Stats->eraseFunction(F);
+    else if (TypedF->use_empty()) Stats->eraseFunction(TypedF);
+  }
+}
+
+
+
+void MergeRustFuncPass::mergeCallee(Module* M, std::string CallerName, std::string CalleeName) {
+  Function* CallerFunc = getCallerFunc(M, CallerName);
   if (!CallerFunc) {
     llvm::errs()<<"MergeCallee Error: cannot find main function\n";
     return;
   }
-  Function *CalleeFunc = M->getFunction("callee_"+CalleeName_rr);
-  Instruction* RPCInst_i = findRPCbyCalleeName(CallerFunc, CalleeName_rr);
-  if (!RPCInst_i) {
+  Function *CalleeFunc = M->getFunction("callee_"+CalleeName);
+  if (!CalleeFunc) {
+    llvm::errs()<<"MergeCallee Error: cannot find callee "<<CalleeName<<"\n";
+    return;
+  }
+  // a caller merged with -zero-copy-args-rr also has a typed copy
+  Function* TypedCallerFunc = M->getFunction("NewCallee_"+CallerName+"_typed");
+  std::vector<Instruction*> RPCInsts = findAllRPCs(CallerFunc, TypedCallerFunc, CalleeName);
+  if (RPCInsts.empty()) {
     llvm::errs()<<"MergeCallee Error: no RPC callee find in the caller function\n";
     return;
   }
 
+  // the first call site clones the callee, the others call the clone
+  Instruction* RPCInst_i = RPCInsts[0];
   Function* NewCalleeFunc;
-  if (isa<InvokeInst>(RPCInst_i)) {
-    InvokeInst* RPCInst = dyn_cast<InvokeInst>(RPCInst_i);
-    NewCalleeFunc = createRustNewCallee(CalleeFunc, RPCInst, CalleeName_rr);
+  {
+    MergePhase Phase(*Stats, "clone");
+    if (isa<InvokeInst>(RPCInst_i)) {
+      InvokeInst* RPCInst = dyn_cast<InvokeInst>(RPCInst_i);
+      NewCalleeFunc = createRustNewCallee(CalleeFunc, RPCInst, CalleeName);
+    }
+    else if (isa<CallInst>(RPCInst_i)) {
+      CallInst* RPCInst = dyn_cast<CallInst>(RPCInst_i);
+      NewCalleeFunc = createRustNewCallee2(CalleeFunc, RPCInst, CalleeName);
+    }
+    Stats->addClonedFunc(NewCalleeFunc);
+    deleteCalleeInputOutputFunc(NewCalleeFunc);
+  }
+  {
+    MergePhase Phase(*Stats, "replace-rpcs");
+    for (unsigned i=1; i<RPCInsts.size(); i++)
+      replaceRPCWithCall(RPCInsts[i], NewCalleeFunc);
+    reportMergedRPCs(CallerName, CalleeName, RPCInsts.size());
   }
-  else if (isa<CallInst>(RPCInst_i)) {
-    CallInst* RPCInst = dyn_cast<CallInst>(RPCInst_i);
-    NewCalleeFunc = createRustNewCallee2(CalleeFunc, RPCInst, CalleeName_rr);
+  if (ZeroCopyArgs_rr) {
+    MergePhase Phase(*Stats, "zero-copy-args");
+    passArgumentsByPointer(CallerFunc, NewCalleeFunc);
+    if (TypedCallerFunc) passArgumentsByPointer(TypedCallerFunc, NewCalleeFunc);
   }
-  deleteCalleeInputOutputFunc(NewCalleeFunc);
     
-  Function* f1 = M->getFunction("main_callee_rust_"+CalleeName_rr);
-  Function* f2 = M->getFunction("_std_rt_lang_start_callee_"+CalleeName_rr);
-  f1->eraseFromParent();
-  f2->eraseFromParent();
-  CalleeFunc->eraseFromParent();
+  MergePhase Phase(*Stats, "erase");
+  Function* f1 = M->getFunction("main_callee_rust_"+CalleeName);
+  Function* f2 = M->getFunction("_std_rt_lang_start_callee_"+CalleeName);
+  // the merged callee runs on the caller's runtime
+  Stats->eraseFunction(f1);
+  Stats->eraseFunction(f2);
+  Stats->eraseFunction(CalleeFunc);
+}
+
+
+
+// the caller is NewCallee_<name> once renamed as a caller or merged, or still
+// callee_<name> when a subtree is merged into its root's own module before
+// that root is merged into its caller (merge_tree.py runs those in parallel)
+Function* MergeRustFuncPass::getCallerFunc(Module* M, std::string CallerName) {
+  Function* CallerFunc = M->getFunction("NewCallee_"+CallerName);
+  if (!CallerFunc) CallerFunc = M->getFunction("callee_"+CallerName);
+  return CallerFunc;
 }
 
 
 
-void MergeRustFuncPass::MergeExistingCallee(Module* M) {
-  Function* CallerFunc = M->getFunction("NewCallee_"+CallerName_rr);
+void MergeRustFuncPass::MergeExistingCallee(Module* M, std::string CallerName, std::string CalleeName) {
+  Function* CallerFunc = getCallerFunc(M, CallerName);
   if (!CallerFunc) {
     llvm::errs()<<"Error: cannot find main function\n";
     return;
   }
 
-  Instruction* RPCInst_i = findRPCbyCalleeName(CallerFunc, CalleeName_rr);
+  Function* TypedCallerFunc = M->getFunction("NewCallee_"+CallerName+"_typed");
+  std::vector<Instruction*> RPCInsts = findAllRPCs(CallerFunc, TypedCallerFunc, CalleeName);
+  if (RPCInsts.empty()) {
+    llvm::errs()<<"Error: no RPC callee find in the caller function\n";
+    return;
+  }
 
-  Function *CalleeFunc = M->getFunction("NewCallee_"+CalleeName_rr);
+  Function *CalleeFunc = M->getFunction("NewCallee_"+CalleeName);
   if (CalleeFunc) {
-    std::vector<Value*> arguments;
-    for (unsigned i=0; i<RPCInst_i->getNumOperands(); i++){
-      Value* arg = RPCInst_i->getOperand(i);
-      if ((i==0) || (i==3) ){
-        arguments.push_back(arg);
-      }
+    {
+      MergePhase Phase(*Stats, "replace-rpcs");
+      for (Instruction* RPCInst_i : RPCInsts)
+        replaceRPCWithCall(RPCInst_i, CalleeFunc);
+      reportMergedRPCs(CallerName, CalleeName, RPCInsts.size());
     }
-
-    CallInst* newCall = CallInst::Create(CalleeFunc->getFunctionType(), CalleeFunc, arguments ,"", RPCInst_i);
-    if (isa<InvokeInst>(RPCInst_i)) {
-      BasicBlock* nextBBofRPC = dyn_cast<BasicBlock>(RPCInst_i->getOperand(4));
-      if (nextBBofRPC)
-        BranchInst * jumpInst = llvm::BranchInst::Create(nextBBofRPC, RPCInst_i);
+    if (ZeroCopyArgs_rr) {
+      MergePhase Phase(*Stats, "zero-copy-args");
+      passArgumentsByPointer(CallerFunc, CalleeFunc);
+      if (TypedCallerFunc) passArgumentsByPointer(TypedCallerFunc, CalleeFunc);
     }
-    RPCInst_i->eraseFromParent();
   }
 }
 
 
 
-std::string MergeRustFuncPass::getRPCCalleeName(Instruction* RPCInst){
-  Value* funcNameValue = RPCInst->getOperand(1);
+// erase a call, for an invoke keep going to its normal destination
+static void eraseCall(CallBase* CB) {
+  if (InvokeInst* II = dyn_cast<InvokeInst>(CB)) {
+    II->getUnwindDest()->removePredecessor(II->getParent());
+    BranchInst::Create(II->getNormalDest(), II);
+  }
+  CB->eraseFromParent();
+}
 
-  std::error_code EC;
-  llvm::raw_fd_ostream output("tmp.txt", EC, sys::fs::OF_Text);
 
-  funcNameValue->print(output);
-  output.close();
 
-  std::ifstream ifs;
-  ifs.open("tmp.txt");
-  std::stringstream oss;
-  oss << ifs.rdbuf();
-  std::string content = oss.str();
-  ifs.close();
-  std::vector<int> idxs;
-  for (int i=0; i<content.size(); i++){
-    if (content[i]=='"') idxs.push_back(i);
+// turn one make_rpc(ret, name, len, input) into NewCallee(ret, input)
+void MergeRustFuncPass::replaceRPCWithCall(Instruction* RPCInst_i, Function* CalleeFunc) {
+  std::vector<Value*> arguments;
+  for (unsigned i=0; i<RPCInst_i->getNumOperands(); i++){
+    Value* arg = RPCInst_i->getOperand(i);
+    if ((i==0) || (i==3) ){
+      arguments.push_back(arg);
+    }
   }
-  std::string fname = content.substr(idxs[0]+1,idxs[1]-idxs[0]-1); 
-  return fname;
+
+  CallInst* newCall = CallInst::Create(CalleeFunc->getFunctionType(), CalleeFunc, arguments ,"", RPCInst_i);
+  newCall->setAttributes(CalleeFunc->getAttributes());
+  eraseCall(dyn_cast<CallBase>(RPCInst_i));
+}
+
+
+
+void MergeRustFuncPass::reportMergedRPCs(std::string CallerName, std::string CalleeName, unsigned NumRPCs) {
+  NumMergedRPCs += NumRPCs;
+  Stats->addMergedEdge(CallerName, CalleeName, NumRPCs);
+  LLVM_DEBUG(dbgs()<<"Merge: "<<CallerName<<" -> "<<CalleeName<<": "<<NumRPCs
+                  <<" make_rpc call(s) turned into direct calls\n");
+}
+
+
+
+std::string MergeRustFuncPass::getRPCCalleeName(Instruction* RPCInst){
+  return Index->getRPCCalleeName(dyn_cast<CallBase>(RPCInst));
 }
 
 
@@ -243,6 +467,7 @@ Function* MergeRustFuncPass::createRustNewCallee(Function* CalleeFunc, InvokeIns
   ValueToValueMapTy VMap;
   SmallVector<ReturnInst*, 8> Returns;
   CloneFunctionInto(NewCalleeFunc, CalleeFunc, VMap, llvm::CloneFunctionChangeType::LocalChangesOnly, Returns);
+  Index->addFunction(NewCalleeFunc);
 
   // set attributes for the new callee function's arguments
   std::vector<AttributeSet> argumentAttrs;
@@ -261,10 +486,7 @@ Function* MergeRustFuncPass::createRustNewCallee(Function* CalleeFunc, InvokeIns
   CallInst* newCall = CallInst::Create(FuncType, NewCalleeFunc, arguments ,"", call);
   AttributeList callInstAttr = call->getAttributes();
   newCall->setAttributes(AttributeList::get(M->getContext(), funcAttr, returnAttr, argumentAttrs));
-  BasicBlock* nextBBofRPC = dyn_cast<BasicBlock>(call->getOperand(4));
-  if (nextBBofRPC)
-    BranchInst * jumpInst = llvm::BranchInst::Create(nextBBofRPC, call);
-  call->eraseFromParent();
+  eraseCall(call);
 
   return NewCalleeFunc;
 }
@@ -298,6 +520,7 @@ Function* MergeRustFuncPass::createRustNewCallee2(Function* CalleeFunc, CallInst
   ValueToValueMapTy VMap;
   SmallVector<ReturnInst*, 8> Returns;
   CloneFunctionInto(NewCalleeFunc, CalleeFunc, VMap, llvm::CloneFunctionChangeType::LocalChangesOnly, Returns);
+  Index->addFunction(NewCalleeFunc);
 
   // set attributes for the new callee function's arguments
   std::vector<AttributeSet> argumentAttrs;
@@ -327,12 +550,13 @@ void MergeRustFuncPass::deleteCalleeInputOutputFunc(Function* NewCalleeFunc){
   Module* M = NewCalleeFunc->getParent();
    // In the new callee function, change the way to get input 
   CallInst* InputFuncCall = getCallByDemangledName(NewCalleeFunc, "OpenFaaSRPC::get_arg_from_caller");
-  Value* allocValue = InputFuncCall->getOperand(0);
   if (!InputFuncCall) return;
+  Value* allocValue = InputFuncCall->getOperand(0);
+  uint64_t StringSize = getRustStringSize(InputFuncCall);
 
   // create call void @llvm.memcpy.p0.p0.i64(ptr align 8 %_0, 
   //                                         ptr align 8 %buffer, 
-  //                                         i64 24, i1 false)
+  //                                         i64 <sizeof String>, i1 false)
   // the is the LLVM Intrinsc. The way to create such a call 
   // is different from normal CallInst create 
 
@@ -346,8 +570,8 @@ void MergeRustFuncPass::deleteCalleeInputOutputFunc(Function* NewCalleeFunc){
   std::vector<Value*> IntrinArguments;
   IntrinArguments.push_back(allocValue);
   IntrinArguments.push_back(NewCalleeFunc->getArg(1));
-  Constant* i64_24 = llvm::ConstantInt::get(Type::getInt64Ty(M->getContext()), 24/*value*/, true);
-  IntrinArguments.push_back(dyn_cast<Value>(i64_24));
+  Constant* i64_size = llvm::ConstantInt::get(Type::getInt64Ty(M->getContext()), StringSize, true);
+  IntrinArguments.push_back(dyn_cast<Value>(i64_size));
   Constant* i1_false = llvm::ConstantInt::get(Type::getInt1Ty(M->getContext()), 0/*value*/, true);
   IntrinArguments.push_back(dyn_cast<Value>(i1_false));
 
@@ -369,13 +593,13 @@ void MergeRustFuncPass::deleteCalleeInputOutputFunc(Function* NewCalleeFunc){
   else OutputFuncCall = dyn_cast<CallInst>(OutputFuncCall_c);
   // create call void @llvm.memcpy.p0.p0.i64(ptr align 8 %_0, 
   //                                         ptr align 8 %buffer, 
-  //                                         i64 24, i1 false)
+  //                                         i64 <sizeof String>, i1 false)
   // the is the LLVM Intrinsc. The way to create such a call 
   // is different from normal CallInst create 
   std::vector<Value*> IntrinsicArguments;
   IntrinsicArguments.push_back(NewCalleeFunc->getArg(0));
   IntrinsicArguments.push_back(OutputFuncCall->getOperand(0));
-  IntrinsicArguments.push_back(dyn_cast<Value>(i64_24));
+  IntrinsicArguments.push_back(dyn_cast<Value>(i64_size));
   IntrinsicArguments.push_back(dyn_cast<Value>(i1_false));
   ArrayRef<Value*> IntrinsicArgs(IntrinsicArguments);
 
@@ -383,112 +607,330 @@ void MergeRustFuncPass::deleteCalleeInputOutputFunc(Function* NewCalleeFunc){
   llvmMemcpyCall->insertBefore(OutputFuncCall);
 
   // delete the send_return_value_to_caller() function call
-  // this function call is a invoke function, so we have to
-  // first create a branch instruction as the terminator and 
-  // then delete this call 
-  if (isa<InvokeInst>(OutputFuncCall)) {
-    BasicBlock* nextBB = dyn_cast<BasicBlock>(OutputFuncCall->getOperand(1));
-    if (nextBB)
-      BranchInst * jumpInst = llvm::BranchInst::Create(nextBB, OutputFuncCall);
+  eraseCall(dyn_cast<CallBase>(OutputFuncCall));
+}
+
+
+
+// the size of the String get_arg_from_caller returns through its sret
+// argument. Without the sret type, String is Vec<u8>: a pointer, a
+// capacity and a length.
+uint64_t MergeRustFuncPass::getRustStringSize(CallBase* InputFuncCall) {
+  const DataLayout& DL = InputFuncCall->getModule()->getDataLayout();
+  Function* InputFunc = InputFuncCall->getCalledFunction();
+  if (InputFunc && InputFunc->getParamStructRetType(0))
+    return DL.getTypeAllocSize(InputFunc->getParamStructRetType(0));
+  return 3 * DL.getPointerSize();
+}
+
+
+
+bool MergeRustFuncPass::isCallTo(User* U, StringRef Prefix, StringRef Suffix) {
+  CallBase* CB = dyn_cast<CallBase>(U);
+  if (!CB || !CB->getCalledFunction()) return false;
+  StringRef name = Index->getDemangledName(CB->getCalledFunction()->getName());
+  return name.starts_with(Prefix) && name.ends_with(Suffix);
+}
+
+
+
+// users that don't read the value: lifetime markers and its drops, which
+// go away together with the value
+bool MergeRustFuncPass::isDropOrMarker(User* U, std::vector<CallBase*>& Drops) {
+  if (IntrinsicInst* II = dyn_cast<IntrinsicInst>(U)) {
+    if (II->isLifetimeStartOrEnd() || isa<DbgInfoIntrinsic>(II)) return true;
+  }
+  if (isCallTo(U, "core::ptr::drop_in_place<", "")) {
+    Drops.push_back(dyn_cast<CallBase>(U));
+    return true;
   }
-  OutputFuncCall->eraseFromParent();
+  return false;
 }
 
 
 
-Instruction* MergeRustFuncPass::findRPCbyCalleeName(Function* f, std::string calleeName){
-  std::string prefix = "OpenFaaSRPC::make_rpc";
-  for (Function::iterator BBB = f->begin(), BBE = f->end(); BBB != BBE; ++BBB){
-    for (BasicBlock::iterator IB = BBB->begin(), IE = BBB->end(); IB != IE; IB++){
-      if ( isa<InvokeInst>(IB) ){
-        InvokeInst* invoke = dyn_cast<InvokeInst>(IB);
-        std::string realname = demangle(invoke->getCalledFunction()->getName());
-        if ((realname.size()>=prefix.size()) && (realname.substr(0, prefix.size())==prefix)) {
-          std::string CalleeName = getRPCCalleeName(invoke);
-          if (CalleeName == calleeName) return dyn_cast<Instruction>(invoke);
-        }
-      }
-      else if (isa<CallInst>(IB)) {
-        CallInst* call = dyn_cast<CallInst>(IB);
-        std::string realname = demangle(call->getCalledFunction()->getName());
-        if ((realname.size()>=prefix.size()) && (realname.substr(0, prefix.size())==prefix)) {
-          std::string CalleeName = getRPCCalleeName(call);
-          if (CalleeName == calleeName) return dyn_cast<CallInst>(call);
-        }
-      }
-    }
+// the typed copy of a merged callee: instead of a String holding the JSON of
+// its argument struct, it takes the struct itself. The callee code
+//   %input = <String from the caller>
+//   serde_json::de::from_str(%res, deref(%input))
+//   Result::unwrap(%args, %res)
+// becomes a move of the caller's struct into %args. The argument size is
+// the sret type of the unwrap, taken from the DataLayout.
+Function* MergeRustFuncPass::getTypedCallee(Function* NewCalleeFunc) {
+  Module* M = NewCalleeFunc->getParent();
+  std::string TypedName = NewCalleeFunc->getName().str()+"_typed";
+  if (Function* TypedFunc = M->getFunction(TypedName)) return TypedFunc;
+
+  ValueToValueMapTy VMap;
+  Function* TypedFunc = CloneFunction(NewCalleeFunc, VMap);
+  TypedFunc->setName(TypedName);
+  Index->addFunction(TypedFunc);
+  if (!rewriteTypedInput(TypedFunc)) {
+    TypedFunc->eraseFromParent();
+    return NULL;
   }
-  return NULL; 
+  Stats->addClonedFunc(TypedFunc);
+  return TypedFunc;
 }
 
 
 
-CallInst* MergeRustFuncPass::getCallByDemangledName(Function* f, std::string fname) {
-  for (Function::iterator BBB = f->begin(), BBE = f->end(); BBB != BBE; ++BBB){
-    for (BasicBlock::iterator IB = BBB->begin(), IE = BBB->end(); IB != IE; IB++){
-      if (isa<CallInst>(IB)){
-        CallInst *ci = dyn_cast<CallInst>(IB);
-        Function* CalledFunc = ci->getCalledFunction();
-        std::string demangled = getDemangledRustFuncName(CalledFunc->getName().str());
-        if (demangled == fname) return ci;
-      }
+bool MergeRustFuncPass::rewriteTypedInput(Function* TypedFunc) {
+  const DataLayout& DL = TypedFunc->getParent()->getDataLayout();
+  Argument* Input = TypedFunc->getArg(1);
+
+  // the String copy deleteCalleeInputOutputFunc put in place of get_arg_from_caller
+  MemCpyInst* InputCopy = NULL;
+  for (User* U : Input->users()) {
+    MemCpyInst* MC = dyn_cast<MemCpyInst>(U);
+    if (MC && (MC->getRawSource() == Input)) InputCopy = MC;
+  }
+  if (!InputCopy) return false;
+  Value* InputString = InputCopy->getRawDest();
+
+  std::vector<CallBase*> FromStrs = Index->getCallSites(TypedFunc, "serde_json::de::from_str");
+  if (FromStrs.size() != 1) return false;
+  CallBase* FromStr = FromStrs[0];
+  Value* Res = FromStr->getArgOperand(0);
+
+  // the &str handed to from_str has to come out of the input String
+  std::vector<Instruction*> StrParts;
+  std::vector<CallBase*> Derefs;
+  for (unsigned i=1; i<FromStr->arg_size(); i++) {
+    ExtractValueInst* EV = dyn_cast<ExtractValueInst>(FromStr->getArgOperand(i));
+    if (!EV || !EV->hasOneUse()) return false;
+    CallBase* Deref = dyn_cast<CallBase>(EV->getAggregateOperand());
+    if (!Deref || (Deref->arg_size() < 1) || (Deref->getArgOperand(0) != InputString)) return false;
+    StrParts.push_back(EV);
+    if (std::find(Derefs.begin(), Derefs.end(), Deref) == Derefs.end()) Derefs.push_back(Deref);
+  }
+  if (Derefs.empty()) return false;
+  for (CallBase* Deref : Derefs) {
+    for (User* U : Deref->users()) {
+      if (std::find(StrParts.begin(), StrParts.end(), U) == StrParts.end()) return false;
+    }
+  }
+
+  std::vector<CallBase*> Drops;
+  for (User* U : InputString->users()) {
+    if ((U == InputCopy) || isDropOrMarker(U, Drops)) continue;
+    if (std::find(Derefs.begin(), Derefs.end(), U) != Derefs.end()) continue;
+    return false;
+  }
+
+  CallBase* Unwrap = NULL;
+  for (User* U : Res->users()) {
+    if ((U == FromStr) || isDropOrMarker(U, Drops)) continue;
+    if (!Unwrap && isCallTo(U, "core::result::Result<", "::unwrap")) {
+      Unwrap = dyn_cast<CallBase>(U);
+      continue;
     }
+    return false;
   }
-  return NULL; 
+  if (!Unwrap || !Unwrap->getCalledFunction()->getParamStructRetType(0)) return false;
+  uint64_t ArgSize = DL.getTypeAllocSize(Unwrap->getCalledFunction()->getParamStructRetType(0));
+
+  IRBuilder<> Builder(Unwrap);
+  Builder.CreateMemCpy(Unwrap->getArgOperand(0), MaybeAlign(), Input, MaybeAlign(), ArgSize);
+  eraseCall(Unwrap);
+  eraseCall(FromStr);
+  for (Instruction* EV : StrParts) EV->eraseFromParent();
+  for (CallBase* Deref : Derefs) eraseCall(Deref);
+  for (CallBase* Drop : Drops) eraseCall(Drop);
+  InputCopy->eraseFromParent();
+  return true;
 }
 
 
 
-InvokeInst* MergeRustFuncPass::getInvokeByDemangledName(Function* f, std::string fname) {
-  for (Function::iterator BBB = f->begin(), BBE = f->end(); BBB != BBE; ++BBB){
-    for (BasicBlock::iterator IB = BBB->begin(), IE = BBB->end(); IB != IE; IB++){
-      if (isa<InvokeInst>(IB)) {
-        InvokeInst* ii = dyn_cast<InvokeInst>(IB);
-        std::string demangled = getDemangledRustFuncName(ii->getCalledFunction()->getName().str());
-        if (demangled == fname) return ii; 
-      } 
+// the size of the argument struct a typed callee takes, see rewriteTypedInput
+uint64_t MergeRustFuncPass::getTypedArgSize(Function* TypedFunc) {
+  for (User* U : TypedFunc->getArg(1)->users()) {
+    MemCpyInst* MC = dyn_cast<MemCpyInst>(U);
+    if (!MC || (MC->getRawSource() != TypedFunc->getArg(1))) continue;
+    if (ConstantInt* len = dyn_cast<ConstantInt>(MC->getLength())) return len->getZExtValue();
+  }
+  return 0;
+}
+
+
+
+// true if V (or an address computed from it) is only used where Point
+// cannot have run yet, besides the users in Allowed and its drops/markers
+bool MergeRustFuncPass::isOnlyUsedBefore(Value* V, Instruction* Point,
+                                         std::vector<Instruction*>& Allowed,
+                                         std::vector<CallBase*>& Drops) {
+  for (User* U : V->users()) {
+    Instruction* I = dyn_cast<Instruction>(U);
+    if (!I) return false;
+    if (std::find(Allowed.begin(), Allowed.end(), I) != Allowed.end()) continue;
+    if (isDropOrMarker(I, Drops)) continue;
+    if (isPotentiallyReachable(Point, I)) return false;
+    if (isa<GetElementPtrInst>(I) || isa<CastInst>(I)) {
+      if (!isOnlyUsedBefore(I, Point, Allowed, Drops)) return false;
     }
   }
-  return NULL; 
+  return true;
 }
 
 
 
-Function* MergeRustFuncPass::getFunctionByDemangledName(Module* M, std::string fname) {
-  for (Module::iterator f = M->begin(); f != M->end(); f++){
-    Function* func = dyn_cast<Function>(f);
-    std::string demangled = getDemangledRustFuncName(func->getName().str());
-    if (demangled == fname) return func;
+// true if the lifetime of V (or of an address computed from it) may end on
+// the way to Point, e.g. a temporary or an inner scope ending before the call
+static bool mayEndLifetimeBefore(Value* V, Instruction* Point) {
+  for (User* U : V->users()) {
+    IntrinsicInst* II = dyn_cast<IntrinsicInst>(U);
+    if (II && (II->getIntrinsicID() == Intrinsic::lifetime_end) &&
+        isPotentiallyReachable(II, Point)) return true;
+    if ((isa<GetElementPtrInst>(U) || isa<CastInst>(U)) && mayEndLifetimeBefore(U, Point))
+      return true;
   }
-  return NULL;
+  return false;
 }
 
 
 
-std::string MergeRustFuncPass::getDemangledRustFuncName(std::string MangledFuncName) {
-  std::string command = demangle_bin + " \'" + MangledFuncName + "\'";
+// caller side of the typed callee. The caller code
+//   serde_json::ser::to_string(%res, %args)
+//   Result::unwrap(%str, %res)
+//   NewCallee(%ret, %str)      ; maybe through a moved copy of %str
+// becomes NewCallee_typed(%ret, %args). The callee owns the struct from then
+// on, so the caller doesn't drop it anymore.
+bool MergeRustFuncPass::passArgumentByPointer(CallInst* Call, Function* TypedFunc) {
+  const DataLayout& DL = Call->getModule()->getDataLayout();
+  std::vector<CallBase*> Drops;
+
+  Value* Str = Call->getArgOperand(1);
+  MemCpyInst* MoveCopy = NULL;
+  CallBase* Unwrap = NULL;
+  for (User* U : Str->users()) {
+    if ((U == Call) || isDropOrMarker(U, Drops)) continue;
+    MemCpyInst* MC = dyn_cast<MemCpyInst>(U);
+    if (MC && !MoveCopy && (MC->getRawDest() == Str)) {
+      MoveCopy = MC;
+      continue;
+    }
+    if (!Unwrap && isCallTo(U, "core::result::Result<", "::unwrap") &&
+        (dyn_cast<CallBase>(U)->getArgOperand(0) == Str)) {
+      Unwrap = dyn_cast<CallBase>(U);
+      continue;
+    }
+    return false;
+  }
+  if (MoveCopy) {
+    if (Unwrap) return false;
+    Value* StrSrc = MoveCopy->getRawSource();
+    for (User* U : StrSrc->users()) {
+      if ((U == MoveCopy) || isDropOrMarker(U, Drops)) continue;
+      if (!Unwrap && isCallTo(U, "core::result::Result<", "::unwrap") &&
+          (dyn_cast<CallBase>(U)->getArgOperand(0) == StrSrc)) {
+        Unwrap = dyn_cast<CallBase>(U);
+        continue;
+      }
+      return false;
+    }
+  }
+  if (!Unwrap) return false;
+
+  Value* Res = Unwrap->getArgOperand(1);
+  CallBase* ToString = NULL;
+  for (User* U : Res->users()) {
+    if ((U == Unwrap) || isDropOrMarker(U, Drops)) continue;
+    if (!ToString && isCallTo(U, "serde_json::ser::to_string", "")) {
+      ToString = dyn_cast<CallBase>(U);
+      continue;
+    }
+    return false;
+  }
+  if (!ToString || (ToString->arg_size() < 2)) return false;
+
+  AllocaInst* Args = dyn_cast<AllocaInst>(ToString->getArgOperand(1)->stripPointerCasts());
+  if (!Args) return false;
+  auto ArgsSize = Args->getAllocationSizeInBits(DL);
+  if (!ArgsSize || (ArgsSize->getFixedValue() != 8 * getTypedArgSize(TypedFunc))) return false;
+  std::vector<Instruction*> Allowed = {ToString};
+  if (!isOnlyUsedBefore(Args, ToString, Allowed, Drops)) return false;
+  // the typed callee reads the struct at Call, its stack slot must still be live
+  if (mayEndLifetimeBefore(Args, Call)) return false;
+
+  Call->setCalledFunction(TypedFunc);
+  Call->setArgOperand(1, ToString->getArgOperand(1));
+  Call->setAttributes(TypedFunc->getAttributes());
+  if (MoveCopy) MoveCopy->eraseFromParent();
+  eraseCall(Unwrap);
+  eraseCall(ToString);
+  for (CallBase* Drop : Drops) eraseCall(Drop);
+  return true;
+}
 
-  char* command_cstr = new char [command.length()+1];
-  strcpy (command_cstr, command.c_str());
 
-  FILE* fp1 = popen(command_cstr, "r");
 
-  while (fp1 == NULL){
-    sleep(1);
-    fp1 = popen(command_cstr, "r");
-    llvm::errs()<<"[tracer] fail to run demangle_rust_funcname\n";
-    llvm::errs()<<command<<"\n";
+void MergeRustFuncPass::passArgumentsByPointer(Function* CallerFunc, Function* NewCalleeFunc) {
+  std::vector<CallInst*> calls;
+  for (User* U : NewCalleeFunc->users()) {
+    CallInst* Call = dyn_cast<CallInst>(U);
+    if (Call && (Call->getFunction() == CallerFunc) && (Call->getCalledFunction() == NewCalleeFunc))
+      calls.push_back(Call);
+  }
+  if (calls.empty()) return;
+  Function* TypedFunc = getTypedCallee(NewCalleeFunc);
+  if (!TypedFunc) {
+    LLVM_DEBUG(dbgs()<<"ZeroCopyArgs: no serde_json argument in "<<NewCalleeFunc->getName()<<"\n");
+    return;
   }
+  unsigned NumTyped = 0;
+  for (CallInst* Call : calls) {
+    if (passArgumentByPointer(Call, TypedFunc)) NumTyped++;
+  }
+  NumTypedCalls += NumTyped;
+  LLVM_DEBUG(dbgs()<<"ZeroCopyArgs: "<<NumTyped<<"/"<<calls.size()<<" call(s) of "
+                  <<NewCalleeFunc->getName()<<" pass the argument struct by pointer\n");
+}
+
 
-  char path1[3000];
-  std::vector<std::string> lines;
-  while (fgets(path1, sizeof(path1), fp1) != NULL) {
-    std::string line(path1);
-    lines.push_back(line);
+
+// the make_rpc calls to the callee in the caller and its typed copy
+std::vector<Instruction*> MergeRustFuncPass::findAllRPCs(Function* CallerFunc, Function* TypedCallerFunc, std::string CalleeName) {
+  MergePhase Phase(*Stats, "find-rpcs");
+  std::vector<Instruction*> RPCInsts = findAllRPCbyCalleeName(CallerFunc, CalleeName);
+  if (TypedCallerFunc) {
+    std::vector<Instruction*> TypedRPCInsts = findAllRPCbyCalleeName(TypedCallerFunc, CalleeName);
+    RPCInsts.insert(RPCInsts.end(), TypedRPCInsts.begin(), TypedRPCInsts.end());
   }
-  pclose(fp1);
-  if (lines.size()==1) { 
-    return lines[0];
+  return RPCInsts;
+}
+
+
+
+// every make_rpc to the callee, e.g. one per fanned out item or branch
+std::vector<Instruction*> MergeRustFuncPass::findAllRPCbyCalleeName(Function* f, std::string calleeName){
+  std::vector<Instruction*> calls;
+  for (CallBase* call : Index->getCallSites(f, "OpenFaaSRPC::make_rpc")) {
+    if (getRPCCalleeName(call) == calleeName) calls.push_back(call);
   }
-  return "";
+  return calls;
+}
+
+
+
+CallInst* MergeRustFuncPass::getCallByDemangledName(Function* f, std::string fname) {
+  return Index->getCall(f, fname);
+}
+
+
+
+InvokeInst* MergeRustFuncPass::getInvokeByDemangledName(Function* f, std::string fname) {
+  return Index->getInvoke(f, fname);
+}
+
+
+
+Function* MergeRustFuncPass::getFunctionByDemangledName(Module* M, std::string fname) {
+  return Index->getFunction(fname);
+}
+
+
+
+std::string MergeRustFuncPass::getDemangledRustFuncName(std::string MangledFuncName) {
+  return Demangler->getDemangledName(MangledFuncName);
 }
@@ -18,12 +18,16 @@
 #include "llvm/Analysis/Passes.h"
 #include "llvm/Analysis/LoopPass.h"
 #include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/CFG.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/ADT/IndexedMap.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/Pass.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/Mangler.h"
@@ -31,6 +35,9 @@
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/Demangle/Demangle.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/MergeSymbolIndex.h"
+#include "llvm/Transforms/Utils/MergePlanner.h"
+#include "llvm/Transforms/Utils/MergeStats.h"
 #include <fstream>
 #include <sstream>
 #include <unistd.h>
@@ -42,24 +49,42 @@ public:
   PreservedAnalyses run(Module &F, ModuleAnalysisManager &AM);
   void renameCallee(Module*);
   void renameCaller(Module*);
-  void mergeCallee(Module*);
-  void MergeExistingCallee(Module*);
+  void mergeCallee(Module*, std::string, std::string);
+  void MergeExistingCallee(Module*, std::string, std::string);
+  Function* getCallerFunc(Module*, std::string);
+  void mergeTree(Module*, std::vector<std::pair<std::string, std::string>>&);
+  bool planMergeTree(Module*, std::vector<std::pair<std::string, std::string>>&);
+  bool getMergeEdges(std::vector<std::pair<std::string, std::string>>&);
   std::string getRPCCalleeName(Instruction* RPCInst);
   Function* createRustNewCallee(Function* CalleeFunc, InvokeInst* call, std::string newName);
   Function* createRustNewCallee2(Function* CalleeFunc, CallInst* call, std::string newName);
   Function* getRustRuntimeFunction(Function* mainFunc);
   void renameRealCallee(Function* mainFunc, std::string newCalleeName);
   void deleteCalleeInputOutputFunc(Function* NewCalleeFunc);
-  Instruction* findRPCbyCalleeName(Function*, std::string);
+  std::vector<Instruction*> findAllRPCs(Function*, Function*, std::string);
+  std::vector<Instruction*> findAllRPCbyCalleeName(Function*, std::string);
+  void replaceRPCWithCall(Instruction*, Function*);
+  void reportMergedRPCs(std::string, std::string, unsigned);
+  uint64_t getRustStringSize(CallBase*);
+  bool isCallTo(User*, StringRef, StringRef);
+  bool isDropOrMarker(User*, std::vector<CallBase*>&);
+  Function* getTypedCallee(Function*);
+  bool rewriteTypedInput(Function*);
+  uint64_t getTypedArgSize(Function*);
+  bool isOnlyUsedBefore(Value*, Instruction*, std::vector<Instruction*>&, std::vector<CallBase*>&);
+  bool passArgumentByPointer(CallInst*, Function*);
+  void passArgumentsByPointer(Function*, Function*);
   bool IsStringStartWith(std::string,std::string);
-  CallInst* getRPCinst(Function*,std::string);
   Function* getFunctionByDemangledName(Module*, std::string);
   InvokeInst* getInvokeByDemangledName(Function*, std::string);
   CallInst* getCallByDemangledName(Function*, std::string);
   std::string getDemangledRustFuncName(std::string);
 
 private:
-  std::string demangle_bin = "/llvm/demangle_rust_funcname";
+  RustDemangleCache* Demangler = nullptr;
+  MergeSymbolIndex* Index = nullptr;
+  MergeStats* Stats = nullptr;
+  unsigned NumMergedRPCs = 0;
 };
 
 } // namespace llvm
@@ -8,7 +8,6 @@
 
 #include "llvm/Transforms/Utils/MergeSwiftRust.h"
 #include <unistd.h>
-#include <sys/wait.h>
 
 using namespace llvm;
 
@@ -31,16 +30,28 @@ static cl::opt<bool> MergeCallee_sr(
 
 PreservedAnalyses MergeSwiftRustPass::run(Module &M,
                                        ModuleAnalysisManager &AM) {
+  SwiftDemangler = &AM.getResult<SwiftDemangleAnalysis>(M);
+  Index = &AM.getResult<MergeSymbolIndexAnalysis>(M);
+  MergeStats RunStats("merge-swift-rust", M);
+  Stats = &RunStats;
   if (RenameCallee_sr) {
+    RunStats.setMode("rename-callee");
+    MergePhase Phase(RunStats, "rename");
     RenameCallee(&M);
   }
   else if (RenameWrappers2c_sr) {
+    RunStats.setMode("rename-wrapper-swift2c");
+    MergePhase Phase(RunStats, "rename");
     RenameWrapperSwift2C(&M);
   }
   else if (RenameWrapperc2r_sr) {
+    RunStats.setMode("rename-wrapper-c2rust");
+    MergePhase Phase(RunStats, "rename");
     RenameWrapperC2Rust(&M); 
   }
   else if (MergeCallee_sr) {
+    RunStats.setMode("merge-callee");
+    MergePhase Phase(RunStats, "merge");
     MergeCallee(&M);
   }
   return PreservedAnalyses::all();
@@ -119,7 +130,9 @@ void MergeSwiftRustPass::MergeCallee(Module* M) {
     llvm::errs()<<"fail to create new callee function\n";
   }
 
-  createCall2NewCallee(dummy_rustCall, newCalleeFunc); 
+  createCall2NewCallee(dummy_rustCall, newCalleeFunc);
+  Stats->addClonedFunc(newCalleeFunc);
+  Stats->addMergedEdge(callerFunc->getName(), calleeFunc->getName(), 1);
 
   // remove drop function in wrapper_c2rust
   removeRustFuncWithVoidRetType(wrapper_c2rustFunc,"core::ptr::drop_in_place<alloc::ffi::c_str::CString>");
@@ -127,82 +140,14 @@ void MergeSwiftRustPass::MergeCallee(Module* M) {
 }
 
 std::string MergeSwiftRustPass::getDemangledSwiftFunctionName(std::string mangledName) {
-  int pipe_to_child[2];   // Pipe for sending data to child (stdin)
-  int pipe_from_child[2]; // Pipe for receiving data from child (stdout)
-  char buffer[1024];
-  if (pipe(pipe_to_child) == -1 || pipe(pipe_from_child) == -1) {
-    perror("pipe");
-  }
-
-  pid_t pid = fork();
-  if (pid == -1) {
-    perror("fork");
-  } 
-  else if (pid == 0) {
-    // Child process
-    close(pipe_to_child[1]); 
-    close(pipe_from_child[0]);
-    // Redirect stdin to read from pipe_to_child
-    dup2(pipe_to_child[0], STDIN_FILENO);
-    close(pipe_to_child[0]); // Close the original descriptor
-    // Redirect stdout to write to pipe_from_child
-    dup2(pipe_from_child[1], STDOUT_FILENO);
-    close(pipe_from_child[1]); 
-
-    execlp("swift-demangle", "swift-demangle", nullptr);
-    perror("execlp"); 
-  } 
-  else {
-    // Parent process
-    close(pipe_to_child[0]); 
-    close(pipe_from_child[1]);
-
-    const char* input = mangledName.c_str();
-    write(pipe_to_child[1], input, strlen(input));
-    close(pipe_to_child[1]); // Close the write end to signal EOF
-    // Read output from the child process's stdout
-    ssize_t bytes_read;
-    while ((bytes_read = read(pipe_from_child[0], buffer, sizeof(buffer) - 1)) > 0) {
-      buffer[bytes_read-1] = '\0'; 
-    }
-    close(pipe_from_child[0]);
-
-    int status;
-    waitpid(pid, &status, 0);
-  }
-  std::string ret(buffer);
-  return ret;
+  return SwiftDemangler->getDemangledName(mangledName);
 }
 
 
 
 
 std::string MergeSwiftRustPass::getDemangledRustFunctionName(std::string MangledFuncName) {
-  std::string command = demangle_bin + " \'" + MangledFuncName + "\'";
-
-  char* command_cstr = new char [command.length()+1];
-  strcpy (command_cstr, command.c_str());
-
-  FILE* fp1 = popen(command_cstr, "r");
-
-  while (fp1 == NULL){
-    sleep(1);
-    fp1 = popen(command_cstr, "r");
-    llvm::errs()<<"[tracer] fail to run demangle_rust_funcname\n";
-    llvm::errs()<<command<<"\n";
-  }
-
-  char path1[3000];
-  std::vector<std::string> lines;
-  while (fgets(path1, sizeof(path1), fp1) != NULL) {
-    std::string line(path1);
-    lines.push_back(line);
-  }
-  pclose(fp1);
-  if (lines.size()==1) { 
-    return lines[0];
-  }
-  return "";
+  return Index->getDemangledName(MangledFuncName);
 }
 
 
@@ -237,46 +182,17 @@ Function* MergeSwiftRustPass::getSwiftFunctionByDemangledName(Module* M, std::st
 
 
 Function* MergeSwiftRustPass::getRustFunctionByDemangledName(Module* M, std::string fname) {
-  for (Module::iterator f = M->begin(); f != M->end(); f++){
-    Function* func = dyn_cast<Function>(f);
-    std::string funcName = func->getName().str();
-    std::string demangledName = getDemangledRustFunctionName(funcName);
-    if (demangledName == fname) {
-      return func;
-    }
-  }
-  return NULL;
+  return Index->getFunction(fname);
 }
 
 
 
 CallInst* MergeSwiftRustPass::getCallInstByCalledFunc(Function* callerFunc, Function* calledFunc) {
-  for (Function::iterator BBB = callerFunc->begin(), BBE = callerFunc->end(); BBB != BBE; ++BBB){
-    for (BasicBlock::iterator IB = BBB->begin(), IE = BBB->end(); IB != IE; IB++){
-      if (isa<CallInst>(IB)) {
-        CallInst* ci = dyn_cast<CallInst>(IB);
-        Function* func = ci->getCalledFunction();
-        if (func == calledFunc) 
-          return ci;
-      }
-    }
-  }
-  return NULL; 
+  return getCallTo(callerFunc, calledFunc);
 }
 
 InvokeInst* MergeSwiftRustPass::getInvokeInstByInvokedFunction(Function* callerFunc, Function* calledFunc) {
-  for (Function::iterator BBB = callerFunc->begin(), BBE = callerFunc->end(); BBB != BBE; ++BBB){
-    for (BasicBlock::iterator IB = BBB->begin(), IE = BBB->end(); IB != IE; IB++){
-      if (isa<InvokeInst>(IB)) {
-        InvokeInst* ii = dyn_cast<InvokeInst>(IB);
-        Function* func = ii->getCalledFunction();
-        if (func == calledFunc) 
-          return ii;
-      }
-    }
-  }
-  return NULL; 
- 
+  return getInvokeTo(callerFunc, calledFunc);
 }
 
 
@@ -31,6 +31,9 @@
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/Demangle/Demangle.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/SwiftDemangle.h"
+#include "llvm/Transforms/Utils/MergeStats.h"
+#include "llvm/Transforms/Utils/MergeSymbolIndex.h"
 #include <fstream>
 #include <sstream>
 #include <unistd.h>
@@ -58,7 +61,9 @@ public:
   void removeRustFuncWithVoidRetType(Function*, std::string);
 
 private:
-  std::string demangle_bin = "/proj/zyuxuanssf-PG0/zyuxuan/faas-test/merge_func/merge-rust-async/demangle_rust_funcname/target/debug/demangle_rust_funcname";
+  SwiftDemangleCache* SwiftDemangler = nullptr;
+  MergeStats* Stats = nullptr;
+  MergeSymbolIndex* Index = nullptr;
 };
 
 } // namespace llvm
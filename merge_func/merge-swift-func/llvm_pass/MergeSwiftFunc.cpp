@@ -8,7 +8,6 @@
 
 #include "llvm/Transforms/Utils/MergeSwiftFunc.h"
 #include <unistd.h>
-#include <sys/wait.h>
 
 using namespace llvm;
 
@@ -27,13 +26,22 @@ static cl::opt<bool> MergeCallee_ss(
 
 PreservedAnalyses MergeSwiftFuncPass::run(Module &M,
                                        ModuleAnalysisManager &AM) {
+  SwiftDemangler = &AM.getResult<SwiftDemangleAnalysis>(M);
+  MergeStats RunStats("merge-swift-func", M);
+  Stats = &RunStats;
   if (RenameCallee_ss) {
+    RunStats.setMode("rename-callee");
+    MergePhase Phase(RunStats, "rename");
     RenameCallee(&M);
   }
   else if (RenameWrapper_ss) {
+    RunStats.setMode("rename-wrapper");
+    MergePhase Phase(RunStats, "rename");
     RenameWrapper(&M);
   }
   else if (MergeCallee_ss) {
+    RunStats.setMode("merge-callee");
+    MergePhase Phase(RunStats, "merge");
     MergeCallee(&M);
   }
   return PreservedAnalyses::all();
@@ -79,55 +87,13 @@ void MergeSwiftFuncPass::MergeCallee(Module* M) {
 
   Function* newCalleeFunc = createNewCalleeFunc(calleeFunc, dummyCall);
 
-  createCall2NewCallee(dummyCall, newCalleeFunc);  
+  createCall2NewCallee(dummyCall, newCalleeFunc);
+  Stats->addClonedFunc(newCalleeFunc);
+  Stats->addMergedEdge(callerFunc->getName(), calleeFunc->getName(), 1);
 }
 
 std::string MergeSwiftFuncPass::getDemangledFunctionName(std::string mangledName) {
-  int pipe_to_child[2];   // Pipe for sending data to child (stdin)
-  int pipe_from_child[2]; // Pipe for receiving data from child (stdout)
-  char buffer[1024];
-  if (pipe(pipe_to_child) == -1 || pipe(pipe_from_child) == -1) {
-    perror("pipe");
-  }
-
-  pid_t pid = fork();
-  if (pid == -1) {
-    perror("fork");
-  } 
-  else if (pid == 0) {
-    // Child process
-    close(pipe_to_child[1]); 
-    close(pipe_from_child[0]);
-    // Redirect stdin to read from pipe_to_child
-    dup2(pipe_to_child[0], STDIN_FILENO);
-    close(pipe_to_child[0]); // Close the original descriptor
-    // Redirect stdout to write to pipe_from_child
-    dup2(pipe_from_child[1], STDOUT_FILENO);
-    close(pipe_from_child[1]); 
-
-    execlp("swift-demangle", "swift-demangle", nullptr);
-    perror("execlp"); 
-  } 
-  else {
-    // Parent process
-    close(pipe_to_child[0]); 
-    close(pipe_from_child[1]);
-
-    const char* input = mangledName.c_str();
-    write(pipe_to_child[1], input, strlen(input));
-    close(pipe_to_child[1]); // Close the write end to signal EOF
-    // Read output from the child process's stdout
-    ssize_t bytes_read;
-    while ((bytes_read = read(pipe_from_child[0], buffer, sizeof(buffer) - 1)) > 0) {
-      buffer[bytes_read-1] = '\0'; 
-    }
-    close(pipe_from_child[0]);
-
-    int status;
-    waitpid(pid, &status, 0);
-  }
-  std::string ret(buffer);
-  return ret;
+  return SwiftDemangler->getDemangledName(mangledName);
 }
 
 
@@ -145,17 +111,7 @@ Function* MergeSwiftFuncPass::getFunctionByDemangledName(Module* M, std::string
 
 
 CallInst* MergeSwiftFuncPass::getCallInstByCalledFunc(Function* callerFunc, Function* calledFunc) {
-  for (Function::iterator BBB = callerFunc->begin(), BBE = callerFunc->end(); BBB != BBE; ++BBB){
-    for (BasicBlock::iterator IB = BBB->begin(), IE = BBB->end(); IB != IE; IB++){
-      if (isa<CallInst>(IB)) {
-        CallInst* ci = dyn_cast<CallInst>(IB);
-        Function* func = ci->getCalledFunction();
-        if (func == calledFunc) 
-          return ci;
-      }
-    }
-  }
-  return NULL; 
+  return getCallTo(callerFunc, calledFunc);
 }
 
 
@@ -31,6 +31,9 @@
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/Demangle/Demangle.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/SwiftDemangle.h"
+#include "llvm/Transforms/Utils/MergeStats.h"
+#include "llvm/Transforms/Utils/MergeSymbolIndex.h"
 #include <fstream>
 #include <sstream>
 #include <unistd.h>
@@ -51,7 +54,8 @@ public:
   void createCall2NewCallee(CallInst*, Function*);
 
 private:
-  std::string demangle_bin = "/proj/zyuxuanssf-PG0/zyuxuan/swift-6.0.3/usr/bin/swift-demangle";
+  SwiftDemangleCache* SwiftDemangler = nullptr;
+  MergeStats* Stats = nullptr;
 };
 
 } // namespace llvm